@@ -0,0 +1,239 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Allocation of the grids (--hugepages=, --numa=). A grid is mapped
+ ** directly with mmap() instead of malloc(), aligned to 2 MiB when it is
+ ** at least that large (otherwise to the page, so always to the 64-byte
+ ** cache line), and
+ **
+ ** - with --hugepages=thp (default) the kernel is asked to back it with
+ **   transparent huge pages (madvise(MADV_HUGEPAGE)); with
+ **   --hugepages=explicit it comes from the hugetlbfs pool
+ **   (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages), falling back to
+ **   transparent huge pages if the pool is empty. A 2 MiB page covers
+ **   512 small ones, which cuts the TLB misses of the sweeps;
+ **
+ ** - with --numa=first-touch (default) the pages are left to the node
+ **   of the thread that writes them first, so the caller must touch the
+ **   grid with the partition of the computation; --numa=interleave
+ **   spreads the pages over all the nodes (mbind(MPOL_INTERLEAVE)), and
+ **   --numa=bind[:N] keeps them on node N (default: the node of the
+ **   calling CPU).
+ **
+ ** mbind() is called through syscall(), so that libnuma is not needed.
+ **
+ ** Requires _DEFAULT_SOURCE before the system headers.
+ **/
+#ifndef HPP_ALLOC_H
+#define HPP_ALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define HPP_HUGE_PAGE ((size_t)2 << 20)
+
+/* from <numaif.h> */
+#define HPP_MPOL_BIND 2
+#define HPP_MPOL_INTERLEAVE 3
+
+typedef enum {
+    HPP_HUGE_OFF,
+    HPP_HUGE_THP,       /* transparent huge pages */
+    HPP_HUGE_EXPLICIT   /* MAP_HUGETLB */
+} hpp_huge_t;
+
+typedef enum {
+    HPP_NUMA_FIRST_TOUCH,
+    HPP_NUMA_INTERLEAVE,
+    HPP_NUMA_BIND
+} hpp_numa_t;
+
+typedef struct {
+    hpp_huge_t huge;
+    hpp_numa_t numa;
+    int node;           /* node of HPP_NUMA_BIND (-1 = local) */
+} hpp_alloc_policy_t;
+
+/* bits of hpp_alloc_status_t.missing */
+#define HPP_ALLOC_NO_HUGETLB 1  /* the hugetlbfs pool could not serve the grid */
+#define HPP_ALLOC_NO_MBIND 2    /* the NUMA policy could not be set */
+
+/* Parts of the policy that were not applied, with the errno of the
+   failed call (saved at once: the fallback overwrites errno) */
+typedef struct {
+    int missing;        /* HPP_ALLOC_* bits */
+    int hugetlb_errno;  /* of mmap(MAP_HUGETLB) */
+    int mbind_errno;    /* of mbind() */
+} hpp_alloc_status_t;
+
+static inline void hpp_alloc_default( hpp_alloc_policy_t *pol )
+{
+    pol->huge = HPP_HUGE_THP;
+    pol->numa = HPP_NUMA_FIRST_TOUCH;
+    pol->node = -1;
+}
+
+/* Parse "off", "thp" or "explicit"; returns 0 on success */
+static inline int hpp_alloc_parse_huge( hpp_alloc_policy_t *pol, const char *s )
+{
+    if (strcmp(s, "off") == 0) {
+        pol->huge = HPP_HUGE_OFF;
+    } else if (strcmp(s, "thp") == 0) {
+        pol->huge = HPP_HUGE_THP;
+    } else if (strcmp(s, "explicit") == 0) {
+        pol->huge = HPP_HUGE_EXPLICIT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Parse "first-touch", "interleave", "bind" or "bind:N"; returns 0 on
+   success */
+static inline int hpp_alloc_parse_numa( hpp_alloc_policy_t *pol, const char *s )
+{
+    char *end;
+
+    pol->node = -1;
+    if (strcmp(s, "first-touch") == 0) {
+        pol->numa = HPP_NUMA_FIRST_TOUCH;
+    } else if (strcmp(s, "interleave") == 0) {
+        pol->numa = HPP_NUMA_INTERLEAVE;
+    } else if (strcmp(s, "bind") == 0) {
+        pol->numa = HPP_NUMA_BIND;
+    } else if (strncmp(s, "bind:", 5) == 0) {
+        pol->numa = HPP_NUMA_BIND;
+        pol->node = (int)strtol(s + 5, &end, 10);
+        if (end == s + 5 || *end != '\0' || pol->node < 0 || pol->node >= 64) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Bytes actually mapped for a grid of `size` bytes */
+static inline size_t hpp_grid_span( size_t size )
+{
+    const size_t unit = (size >= HPP_HUGE_PAGE) ? HPP_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+    return (size + unit - 1) / unit * unit;
+}
+
+/* Apply the huge page and NUMA parts of `pol` to the whole pages inside
+   [p, p+size), before they are touched; what could not be done is
+   added to `st` */
+static inline void hpp_grid_place( void *p, size_t size, const hpp_alloc_policy_t *pol,
+                                   hpp_alloc_status_t *st )
+{
+    const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t lo = ((uintptr_t)p + page - 1) & ~(page - 1);
+    const uintptr_t hi = ((uintptr_t)p + size) & ~(page - 1);
+
+    if (hi <= lo) {
+        return;
+    }
+#ifdef MADV_HUGEPAGE
+    if (pol->huge != HPP_HUGE_OFF) {
+        /* only a hint: without THP support the pages stay small */
+        madvise((void*)lo, hi - lo, MADV_HUGEPAGE);
+    }
+#endif
+    if (pol->numa != HPP_NUMA_FIRST_TOUCH) {
+#if defined(__linux__) && defined(SYS_mbind)
+        unsigned long mask = ~0ul;
+        int mode = HPP_MPOL_INTERLEAVE;
+
+        if (pol->numa == HPP_NUMA_BIND) {
+            unsigned cpu, node = 0;
+            if (pol->node >= 0) {
+                node = (unsigned)pol->node;
+            } else if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+                node = 0;
+            }
+            mask = 1ul << node;
+            mode = HPP_MPOL_BIND;
+        }
+        if (syscall(SYS_mbind, (void*)lo, (unsigned long)(hi - lo), mode, &mask,
+                    (unsigned long)(8 * sizeof(mask)), 0u) != 0) {
+            st->missing |= HPP_ALLOC_NO_MBIND;
+            st->mbind_errno = errno;
+        }
+#else
+        st->missing |= HPP_ALLOC_NO_MBIND;
+        st->mbind_errno = ENOSYS;
+#endif
+    }
+}
+
+/* Map a grid of `size` bytes with the policy `pol`; the pages are not
+   touched. Returns NULL if the memory is exhausted; `st` gets the
+   parts of the policy that were not applied. */
+static inline void *hpp_grid_alloc( size_t size, const hpp_alloc_policy_t *pol,
+                                    hpp_alloc_status_t *st )
+{
+    const size_t span = hpp_grid_span(size);
+    uint8_t *p = MAP_FAILED;
+
+    memset(st, 0, sizeof(*st));
+    if (size == 0) {
+        return NULL;
+    }
+    if (pol->huge == HPP_HUGE_EXPLICIT) {
+#ifdef MAP_HUGETLB
+        if (size >= HPP_HUGE_PAGE) {
+            p = (uint8_t*)mmap(NULL, span, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (p == MAP_FAILED && size >= HPP_HUGE_PAGE) {
+            st->missing |= HPP_ALLOC_NO_HUGETLB;
+#ifdef MAP_HUGETLB
+            st->hugetlb_errno = errno;
+#else
+            st->hugetlb_errno = ENOSYS;
+#endif
+        }
+    }
+    if (p == MAP_FAILED && size >= HPP_HUGE_PAGE) {
+        /* map one huge page more and unmap what is outside the aligned span */
+        uint8_t *raw = (uint8_t*)mmap(NULL, span + HPP_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            return NULL;
+        }
+        p = (uint8_t*)(((uintptr_t)raw + HPP_HUGE_PAGE - 1) & ~(uintptr_t)(HPP_HUGE_PAGE - 1));
+        if (p > raw) {
+            munmap(raw, (size_t)(p - raw));
+        }
+        if (raw + HPP_HUGE_PAGE > p) {
+            munmap(p + span, (size_t)(raw + HPP_HUGE_PAGE - p));
+        }
+    } else if (p == MAP_FAILED) {
+        p = (uint8_t*)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+    }
+    hpp_grid_place(p, span, pol, st);
+    return p;
+}
+
+static inline void hpp_grid_free( void *p, size_t size )
+{
+    if (p != NULL) {
+        munmap(p, hpp_grid_span(size));
+    }
+}
+
+#endif
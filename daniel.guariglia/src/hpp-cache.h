@@ -0,0 +1,139 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Cache of rasterized scenarios (--cache=dir). The initial grid
+ ** produced by read_problem() depends only on the content of the input
+ ** file, on the size of the domain and on the PRNG seed, so it is stored
+ ** in the cache directory under a name derived from these values; later
+ ** runs map it instead of parsing and rasterizing the scenario again.
+ ** Entries are written to a temporary file and renamed, so concurrent
+ ** runs never see a partial entry. An entry is the key below followed
+ ** by the Nx*Ny cells of the grid.
+ **
+ ** Requires _POSIX_C_SOURCE >= 200809L before the system headers.
+ **/
+#ifndef HPP_CACHE_H
+#define HPP_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HPP_CACHE_MAGIC "HPPGRID"
+#define HPP_CACHE_VERSION 1u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint64_t hash;      /* FNV-1a of the input file */
+    uint32_t Nx, Ny;
+} hpp_cache_key_t;
+
+/* 64-bit FNV-1a hash of the whole content of `f`, which is rewound */
+static inline uint64_t hpp_cache_hash_file( FILE *f )
+{
+    uint64_t h = 14695981039346656037ULL;
+    int ch;
+
+    rewind(f);
+    while ((ch = getc(f)) != EOF) {
+        h ^= (unsigned char)ch;
+        h *= 1099511628211ULL;
+    }
+    rewind(f);
+    return h;
+}
+
+/* Key of the scenario read from `filein` on a domain of Nx*Ny cells */
+static inline void hpp_cache_key( hpp_cache_key_t *key, FILE *filein, int Nx, int Ny,
+                                  unsigned seed )
+{
+    memset(key, 0, sizeof(*key));
+    memcpy(key->magic, HPP_CACHE_MAGIC, sizeof(HPP_CACHE_MAGIC));
+    key->version = HPP_CACHE_VERSION;
+    key->seed = seed;
+    key->hash = hpp_cache_hash_file(filein);
+    key->Nx = (uint32_t)Nx;
+    key->Ny = (uint32_t)Ny;
+}
+
+static inline void hpp_cache_path( char *fname, size_t len, const char *cache_dir,
+                                   const hpp_cache_key_t *key )
+{
+    snprintf(fname, len, "%s/hpp-%016llx-%ux%u-%u-v%u.grid", cache_dir,
+             (unsigned long long)key->hash, (unsigned)key->Nx, (unsigned)key->Ny,
+             (unsigned)key->seed, (unsigned)key->version);
+}
+
+/* Copy the cached grid matching `key` into `grid`; returns 0 on a hit */
+static inline int hpp_cache_load( const char *cache_dir, const hpp_cache_key_t *key,
+                                  unsigned char *grid )
+{
+    char fname[4096];
+    struct stat st;
+    const size_t GRID_SIZE = (size_t)key->Nx * key->Ny;
+    void *map;
+    int fd, hit;
+
+    hpp_cache_path(fname, sizeof(fname), cache_dir, key);
+    if ((fd = open(fname, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != sizeof(hpp_cache_key_t) + GRID_SIZE) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    hit = (memcmp(map, key, sizeof(hpp_cache_key_t)) == 0);
+    if (hit) {
+        memcpy(grid, (const char*)map + sizeof(hpp_cache_key_t), GRID_SIZE);
+    }
+    munmap(map, st.st_size);
+    return hit ? 0 : -1;
+}
+
+/* Store `grid` in the cache under `key`; failures are not fatal */
+static inline void hpp_cache_store( const char *cache_dir, const hpp_cache_key_t *key,
+                                    const unsigned char *grid )
+{
+    char tmpname[4096], fname[4096];
+    const size_t GRID_SIZE = (size_t)key->Nx * key->Ny;
+    FILE *f;
+    int fd, ok;
+
+    mkdir(cache_dir, 0777); /* may already exist */
+    snprintf(tmpname, sizeof(tmpname), "%s/.hpp-grid-XXXXXX", cache_dir);
+    if ((fd = mkstemp(tmpname)) < 0 || (f = fdopen(fd, "wb")) == NULL) {
+        fprintf(stderr, "WARNING: can not write to cache directory \"%s\"\n", cache_dir);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmpname);
+        }
+        return;
+    }
+    fchmod(fd, 0644); /* mkstemp() creates the file private to the owner */
+    ok = (fwrite(key, sizeof(hpp_cache_key_t), 1, f) == 1 &&
+          fwrite(grid, 1, GRID_SIZE, f) == GRID_SIZE);
+    ok = (fflush(f) == 0) && ok;
+    ok = (fsync(fd) == 0) && ok;
+    ok = (fclose(f) == 0) && ok;
+    hpp_cache_path(fname, sizeof(fname), cache_dir, key);
+    if (!ok || rename(tmpname, fname) != 0) {
+        fprintf(stderr, "WARNING: can not store \"%s\" in the cache\n", fname);
+        unlink(tmpname);
+    }
+}
+
+#endif
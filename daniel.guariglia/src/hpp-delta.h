@@ -0,0 +1,398 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Delta-encoded frame stream (--delta=k): instead of one Nx*Ny PGM per
+ ** frame the simulators append every frame to a single file, storing a
+ ** keyframe every k frames and, in between, the XOR of each frame with
+ ** the previous one. Walls never move and the gas moves locally, so
+ ** the XOR is mostly zero; it is compressed with a run-length code.
+ ** The frame is split into bands of rows (tiles) encoded and decoded
+ ** independently, in parallel when compiled with OpenMP.
+ **
+ ** File layout (native byte order):
+ **
+ **     header:  "HPPDELTA" version Nx Ny keyint tile_rows  (8 + 5*4 bytes)
+ **     frame:   size frameno type len[ntiles] payload[ntiles]
+ **
+ ** where `size` (8 bytes) counts the bytes of the frame record after
+ ** itself, so that the decoder can skip frames; `type` is 0 for a
+ ** keyframe, encoded as a delta against a frame of EMPTY cells, and 1
+ ** for a delta against the previous frame. A payload is a sequence of
+ ** (zero run, literal run) pairs of LEB128 varints, each literal run
+ ** followed by its XOR bytes.
+ **
+ ** Requires _POSIX_C_SOURCE >= 200112L (fseeko()) before the system
+ ** headers.
+ **/
+#ifndef HPP_DELTA_H
+#define HPP_DELTA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HPP_DELTA_VERSION 1u
+/* bytes per tile, about */
+#define HPP_DELTA_TILE_BYTES 65536
+/* zero runs shorter than this stay inside the literal runs */
+#define HPP_DELTA_MIN_ZEROS 8
+/* value of an EMPTY cell, the reference of the keyframes */
+#define HPP_DELTA_EMPTY 2
+
+typedef struct {
+    FILE *f;
+    uint32_t Nx, Ny, keyint, tile_rows, ntiles;
+    uint32_t frames;            /* frames written */
+    unsigned char *prev;        /* previous frame */
+    unsigned char *empty;       /* one tile of EMPTY cells */
+    unsigned char *out;         /* encoded tiles, tile_cap bytes each */
+    size_t tile_cap;
+    uint32_t *len;              /* encoded length of each tile */
+    uint64_t bytes_out;         /* bytes written to the stream */
+} hpp_delta_writer_t;
+
+typedef struct {
+    FILE *f;
+    uint32_t Nx, Ny, keyint, tile_rows, ntiles;
+    off_t first;                /* offset of the first frame record */
+    unsigned char *in;          /* payloads of one frame */
+    size_t in_cap;
+    uint32_t *len;
+} hpp_delta_reader_t;
+
+static inline size_t hpp_delta_put_varint( unsigned char *out, uint64_t v )
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+/* Returns the bytes read, 0 if the varint does not end before `end` */
+static inline size_t hpp_delta_get_varint( const unsigned char *in, const unsigned char *end,
+                                           uint64_t *v )
+{
+    size_t n = 0;
+    int shift = 0;
+
+    *v = 0;
+    while (in + n < end && shift < 64) {
+        const unsigned char b = in[n++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return n;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+/* Encode the XOR of the `n` cells of `cur` and `ref` into `out` (at
+   most 2n+32 bytes); returns the encoded length */
+static inline size_t hpp_delta_encode_tile( const unsigned char *cur, const unsigned char *ref,
+                                            size_t n, unsigned char *out )
+{
+    size_t i = 0, o = 0, k;
+
+    while (i < n) {
+        size_t z = i, lit;
+        while (z < n && cur[z] == ref[z]) {
+            z++;
+        }
+        /* the literal run ends at the first long enough zero run */
+        lit = z;
+        while (lit < n) {
+            if (cur[lit] != ref[lit]) {
+                lit++;
+            } else {
+                size_t e = lit;
+                while (e < n && e - lit < HPP_DELTA_MIN_ZEROS && cur[e] == ref[e]) {
+                    e++;
+                }
+                if (e == n || e - lit >= HPP_DELTA_MIN_ZEROS) {
+                    break;
+                }
+                lit = e;
+            }
+        }
+        o += hpp_delta_put_varint(out + o, z - i);
+        o += hpp_delta_put_varint(out + o, lit - z);
+        /* four 2-bit XOR values per byte, the first in the low bits */
+        for (k=z; k<lit; k+=4) {
+            unsigned char b = 0;
+            int q;
+            for (q=0; q<4 && k+q<lit; q++) {
+                b |= (unsigned char)((cur[k+q] ^ ref[k+q]) << (2*q));
+            }
+            out[o++] = b;
+        }
+        i = lit;
+    }
+    return o;
+}
+
+/* XOR the encoded tile `in` (`len` bytes) into the `n` bytes of
+   `frame`; returns 0 on success, -1 if the payload is malformed */
+static inline int hpp_delta_decode_tile( const unsigned char *in, size_t len,
+                                         unsigned char *frame, size_t n )
+{
+    const unsigned char *end = in + len;
+    size_t i = 0, m;
+    uint64_t z, lit;
+
+    while (in < end) {
+        if ((m = hpp_delta_get_varint(in, end, &z)) == 0) {
+            return -1;
+        }
+        in += m;
+        if ((m = hpp_delta_get_varint(in, end, &lit)) == 0) {
+            return -1;
+        }
+        in += m;
+        if (z > n - i || lit > n - i - z || (lit + 3) / 4 > (uint64_t)(end - in)) {
+            return -1;
+        }
+        i += z;
+        for (m=0; m<lit; m++) {
+            frame[i++] ^= (in[m/4] >> (2*(m%4))) & 3;
+        }
+        in += (lit + 3) / 4;
+    }
+    return 0;
+}
+
+/* Free the buffers of `w` (those not allocated yet are NULL) */
+static inline void hpp_delta_free( hpp_delta_writer_t *w )
+{
+    free(w->prev);
+    free(w->empty);
+    free(w->out);
+    free(w->len);
+    w->prev = w->empty = w->out = NULL;
+    w->len = NULL;
+}
+
+/* Create the stream `fname` for frames of Ny rows of Nx cells with a
+   keyframe every `keyint` frames; returns 0 on success, -1 otherwise */
+static inline int hpp_delta_open( hpp_delta_writer_t *w, const char *fname, int Nx, int Ny,
+                                  int keyint )
+{
+    static const char magic[8] = {'H', 'P', 'P', 'D', 'E', 'L', 'T', 'A'};
+    uint32_t hdr[5];
+
+    memset(w, 0, sizeof(*w));
+    if ((w->f = fopen(fname, "wb")) == NULL) {
+        return -1;
+    }
+    w->Nx = (uint32_t)Nx;
+    w->Ny = (uint32_t)Ny;
+    w->keyint = (uint32_t)keyint;
+    w->tile_rows = (Nx >= HPP_DELTA_TILE_BYTES) ? 1 : (uint32_t)(HPP_DELTA_TILE_BYTES / Nx);
+    w->ntiles = (w->Ny + w->tile_rows - 1) / w->tile_rows;
+    w->tile_cap = 2 * (size_t)w->tile_rows * Nx + 32;
+    w->prev = (unsigned char*)malloc((size_t)Nx * Ny);
+    w->empty = (unsigned char*)malloc((size_t)w->tile_rows * Nx);
+    w->out = (unsigned char*)malloc(w->tile_cap * w->ntiles);
+    w->len = (uint32_t*)malloc(w->ntiles * sizeof(uint32_t));
+    if (w->prev == NULL || w->empty == NULL || w->out == NULL || w->len == NULL) {
+        hpp_delta_free(w);
+        fclose(w->f);
+        return -1;
+    }
+    memset(w->empty, HPP_DELTA_EMPTY, (size_t)w->tile_rows * Nx);
+    hdr[0] = HPP_DELTA_VERSION;
+    hdr[1] = w->Nx;
+    hdr[2] = w->Ny;
+    hdr[3] = w->keyint;
+    hdr[4] = w->tile_rows;
+    fwrite(magic, 1, sizeof(magic), w->f);
+    fwrite(hdr, sizeof(uint32_t), 5, w->f);
+    w->bytes_out = sizeof(magic) + sizeof(hdr);
+    return 0;
+}
+
+/* Append `frame` (Nx*Ny cells) to the stream */
+static inline void hpp_delta_write( hpp_delta_writer_t *w, const unsigned char *frame )
+{
+    const int key = (w->frames % w->keyint == 0);
+    const size_t Nx = w->Nx, Ny = w->Ny;
+    uint32_t head[2];
+    uint64_t size = sizeof(head) + w->ntiles * sizeof(uint32_t);
+    int t;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (t=0; t<(int)w->ntiles; t++) {
+        const size_t r0 = (size_t)t * w->tile_rows;
+        const size_t nrows = (r0 + w->tile_rows <= Ny) ? w->tile_rows : Ny - r0;
+        const unsigned char *cur = frame + r0 * Nx;
+        unsigned char *prev = w->prev + r0 * Nx;
+        w->len[t] = (uint32_t)hpp_delta_encode_tile(cur, key ? w->empty : prev, nrows * Nx,
+                                                    w->out + t * w->tile_cap);
+        memcpy(prev, cur, nrows * Nx);
+    }
+    for (t=0; t<(int)w->ntiles; t++) {
+        size += w->len[t];
+    }
+    head[0] = w->frames;
+    head[1] = key ? 0 : 1;
+    fwrite(&size, sizeof(size), 1, w->f);
+    fwrite(head, sizeof(uint32_t), 2, w->f);
+    fwrite(w->len, sizeof(uint32_t), w->ntiles, w->f);
+    for (t=0; t<(int)w->ntiles; t++) {
+        fwrite(w->out + t * w->tile_cap, 1, w->len[t], w->f);
+    }
+    w->bytes_out += sizeof(size) + size;
+    w->frames++;
+}
+
+/* Close the stream; returns 0 if everything was written */
+static inline int hpp_delta_close( hpp_delta_writer_t *w )
+{
+    const int err = ferror(w->f);
+
+    hpp_delta_free(w);
+    return (fclose(w->f) != 0 || err) ? -1 : 0;
+}
+
+/* Open the stream `fname` for reading; returns 0 on success, -1 if it
+   can not be opened or is not a delta stream */
+static inline int hpp_delta_read_open( hpp_delta_reader_t *r, const char *fname )
+{
+    char magic[8];
+    uint32_t hdr[5];
+
+    memset(r, 0, sizeof(*r));
+    if ((r->f = fopen(fname, "rb")) == NULL) {
+        return -1;
+    }
+    if (fread(magic, 1, sizeof(magic), r->f) != sizeof(magic) ||
+        memcmp(magic, "HPPDELTA", sizeof(magic)) != 0 ||
+        fread(hdr, sizeof(uint32_t), 5, r->f) != 5 || hdr[0] != HPP_DELTA_VERSION ||
+        hdr[1] == 0 || hdr[2] == 0 || hdr[3] == 0 || hdr[4] == 0) {
+        fclose(r->f);
+        return -1;
+    }
+    r->Nx = hdr[1];
+    r->Ny = hdr[2];
+    r->keyint = hdr[3];
+    r->tile_rows = hdr[4];
+    r->ntiles = (r->Ny + r->tile_rows - 1) / r->tile_rows;
+    r->first = ftello(r->f);
+    r->len = (uint32_t*)malloc(r->ntiles * sizeof(uint32_t));
+    if (r->len == NULL) {
+        fclose(r->f);
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the next frame record and apply it to `frame`; returns 0 on
+   success, -1 at the end of the stream or on a malformed record */
+static inline int hpp_delta_read_next( hpp_delta_reader_t *r, unsigned char *frame,
+                                       uint32_t *frameno )
+{
+    const size_t Nx = r->Nx, Ny = r->Ny;
+    uint64_t size, offset = 0;
+    uint32_t head[2];
+    size_t *start;
+    int t, bad = 0;
+
+    if (fread(&size, sizeof(size), 1, r->f) != 1 ||
+        fread(head, sizeof(uint32_t), 2, r->f) != 2 || head[1] > 1 ||
+        fread(r->len, sizeof(uint32_t), r->ntiles, r->f) != r->ntiles ||
+        size < sizeof(head) + r->ntiles * sizeof(uint32_t)) {
+        return -1;
+    }
+    size -= sizeof(head) + r->ntiles * sizeof(uint32_t);
+    if (size > r->in_cap) {
+        free(r->in);
+        r->in_cap = size;
+        if ((r->in = (unsigned char*)malloc(size)) == NULL) {
+            r->in_cap = 0;
+            return -1;
+        }
+    }
+    if (fread(r->in, 1, size, r->f) != size) {
+        return -1;
+    }
+    start = (size_t*)malloc(r->ntiles * sizeof(size_t));
+    if (start == NULL) {
+        return -1;
+    }
+    for (t=0; t<(int)r->ntiles; t++) {
+        start[t] = offset;
+        offset += r->len[t];
+    }
+    if (offset != size) {
+        free(start);
+        return -1;
+    }
+    if (head[1] == 0) {
+        memset(frame, HPP_DELTA_EMPTY, Nx * Ny);
+    }
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(|:bad)
+#endif
+    for (t=0; t<(int)r->ntiles; t++) {
+        const size_t r0 = (size_t)t * r->tile_rows;
+        const size_t nrows = (r0 + r->tile_rows <= Ny) ? r->tile_rows : Ny - r0;
+        bad |= hpp_delta_decode_tile(r->in + start[t], r->len[t], frame + r0 * Nx, nrows * Nx) != 0;
+    }
+    free(start);
+    *frameno = head[0];
+    return bad ? -1 : 0;
+}
+
+/* Skip the next frame record; returns 0 on success, -1 at the end */
+static inline int hpp_delta_skip( hpp_delta_reader_t *r )
+{
+    uint64_t size;
+
+    if (fread(&size, sizeof(size), 1, r->f) != 1) {
+        return -1;
+    }
+    return fseeko(r->f, (off_t)size, SEEK_CUR);
+}
+
+/* Rebuild frame `frameno` into `frame` (Nx*Ny cells), decoding from the
+   keyframe that precedes it; returns 0 on success, -1 otherwise */
+static inline int hpp_delta_read_frame( hpp_delta_reader_t *r, uint32_t frameno,
+                                        unsigned char *frame )
+{
+    const uint32_t key = frameno - frameno % r->keyint;
+    uint32_t f, got;
+
+    if (fseeko(r->f, r->first, SEEK_SET) != 0) {
+        return -1;
+    }
+    for (f=0; f<key; f++) {
+        if (hpp_delta_skip(r) != 0) {
+            return -1;
+        }
+    }
+    for (f=key; f<=frameno; f++) {
+        if (hpp_delta_read_next(r, frame, &got) != 0 || got != f) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline void hpp_delta_read_close( hpp_delta_reader_t *r )
+{
+    free(r->in);
+    free(r->len);
+    fclose(r->f);
+}
+
+#endif
@@ -0,0 +1,256 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** In-situ previews (--preview=S, --roi=x,y,w,h): instead of the full
+ ** Nx*Ny frame the simulators write
+ **
+ ** - a mipmap of the gas density: the grid is reduced to blocks of f*f
+ **   cells (f the smallest power of two that gives at most S pixels on
+ **   the longer side), then halved again and again down to one pixel.
+ **   All levels go in one PGM, the base on the left and the smaller
+ **   levels stacked on its right. A pixel is the mean of the cells of
+ **   its block on the grey scale of the full image (wall 0, gas 127,
+ **   empty 255), so an all-gas block is mid-grey and an all-wall one
+ **   black;
+ **
+ ** - a crop of the grid at full resolution, with the cell values of the
+ **   full image.
+ **
+ ** The counts are computed per band of rows, so that each MPI process
+ ** can count its own rows; the bands are then summed (MPI_Reduce) and
+ ** the pyramid is built from the sum. With `transposed` set the bands
+ ** are stored transposed, each stored row being a column of the grid.
+ **/
+#ifndef HPP_PREVIEW_H
+#define HPP_PREVIEW_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* cell values of the simulators */
+#define HPP_PREVIEW_WALL 0
+#define HPP_PREVIEW_GAS 1
+
+typedef struct {
+    int Nx, Ny;     /* columns and rows of the grid */
+    int f;          /* side of the blocks of the base level */
+    int W, H;       /* width and height of the base level, in pixels */
+    int max_side;   /* requested side S (0 = no preview) */
+    int roi[4];     /* x, y, w, h of the crop (w == 0: no crop) */
+    int transposed; /* the bands hold columns of the grid */
+} hpp_preview_t;
+
+/* Choose the base level of the pyramid for a grid of Ny rows of Nx
+   cells, without crop */
+static inline void hpp_preview_init( hpp_preview_t *pv, int Nx, int Ny, int max_side )
+{
+    const int longer = (Nx > Ny) ? Nx : Ny;
+
+    pv->Nx = Nx;
+    pv->Ny = Ny;
+    pv->max_side = max_side;
+    pv->f = 1;
+    while (max_side > 0 && (longer + pv->f - 1) / pv->f > max_side) {
+        pv->f *= 2;
+    }
+    pv->W = (Nx + pv->f - 1) / pv->f;
+    pv->H = (Ny + pv->f - 1) / pv->f;
+    pv->roi[2] = 0;
+    pv->transposed = 0;
+}
+
+/* Parse "x,y,w,h" into pv->roi; returns 0 if it is a crop of the grid */
+static inline int hpp_preview_parse_roi( hpp_preview_t *pv, const char *s )
+{
+    int *r = pv->roi;
+
+    if (sscanf(s, "%d,%d,%d,%d", &r[0], &r[1], &r[2], &r[3]) != 4 || r[0] < 0 || r[1] < 0 ||
+        r[2] < 1 || r[3] < 1 || r[0] + r[2] > pv->Nx || r[1] + r[3] > pv->Ny) {
+        r[2] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Add the gas and wall cells of the `nrows` rows starting at stored row
+   `row0` (stored in `rows`) to the counts of the base level (W*H each) */
+static inline void hpp_preview_count( const hpp_preview_t *pv, const unsigned char *rows,
+                                      int row0, int nrows, uint32_t *gas, uint32_t *wall )
+{
+    const int f = pv->f, W = pv->W;
+    const int len = pv->transposed ? pv->Ny : pv->Nx;
+    const int p0 = row0 / f, p1 = (row0 + nrows - 1) / f;
+    int p;
+
+    /* a pixel row (a pixel column if transposed) is counted by one
+       thread only */
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+#endif
+    for (p=p0; p<=p1; p++) {
+        const int i0 = (p*f > row0) ? p*f : row0;
+        const int i1 = ((p+1)*f < row0 + nrows) ? (p+1)*f : row0 + nrows;
+        int i, j;
+        for (i=i0; i<i1; i++) {
+            const unsigned char *row = rows + (size_t)(i - row0) * len;
+            for (j=0; j<len; j++) {
+                const size_t k = pv->transposed ? (size_t)(j/f)*W + p : (size_t)p*W + j/f;
+                gas[k] += (row[j] == HPP_PREVIEW_GAS);
+                wall[k] += (row[j] == HPP_PREVIEW_WALL);
+            }
+        }
+    }
+}
+
+/* Copy the cells of the crop among the `nrows` rows starting at stored
+   row `row0` into `crop` (w*h cells) */
+static inline void hpp_preview_crop( const hpp_preview_t *pv, const unsigned char *rows,
+                                     int row0, int nrows, unsigned char *crop )
+{
+    const int *r = pv->roi;
+    int i, j;
+
+    if (pv->transposed) {
+        for (j=r[0]; j<r[0]+r[2]; j++) {
+            if (j >= row0 && j < row0 + nrows) {
+                for (i=r[1]; i<r[1]+r[3]; i++) {
+                    crop[(size_t)(i - r[1]) * r[2] + j - r[0]] = rows[(size_t)(j - row0) * pv->Ny + i];
+                }
+            }
+        }
+        return;
+    }
+    for (i=r[1]; i<r[1]+r[3]; i++) {
+        if (i >= row0 && i < row0 + nrows) {
+            memcpy(crop + (size_t)(i - r[1]) * r[2], rows + (size_t)(i - row0) * pv->Nx + r[0], r[2]);
+        }
+    }
+}
+
+/* Pixel of a block of `cells` cells: the mean shade of its cells */
+static inline unsigned char hpp_preview_shade( uint32_t gas, uint32_t wall, uint32_t cells )
+{
+    const uint64_t empty = cells - gas - wall;
+    return (unsigned char)((255u * empty + 127u * (uint64_t)gas + cells/2) / (cells ? cells : 1));
+}
+
+/* Build the pyramid from the counts of the base level and write it to
+   `fname`; returns 0 on success, -1 otherwise */
+static inline int hpp_preview_write( const hpp_preview_t *pv, const uint32_t *gas,
+                                     const uint32_t *wall, const char *fname )
+{
+    const int W = pv->W, H = pv->H;
+    const size_t npix = (size_t)W * H;
+    int width = W, height = H, w = W, h = H, stacked = 0, x0 = 0, y0 = 0, i, j;
+    unsigned char *img;
+    uint32_t *g, *wl, *c;
+    FILE *f;
+
+    /* the levels after the base are stacked in a column of width W/2 */
+    while (w > 1 || h > 1) {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        stacked += h;
+    }
+    if (W > 1 || H > 1) {
+        width = W + (W + 1) / 2;
+        height = (stacked > H) ? stacked : H;
+    }
+    img = (unsigned char*)malloc((size_t)width * height);
+    g = (uint32_t*)malloc(npix * sizeof(uint32_t));
+    wl = (uint32_t*)malloc(npix * sizeof(uint32_t));
+    c = (uint32_t*)malloc(npix * sizeof(uint32_t));
+    if (img == NULL || g == NULL || wl == NULL || c == NULL) {
+        free(img); free(g); free(wl); free(c);
+        return -1;
+    }
+    memset(img, 255, (size_t)width * height);
+    memcpy(g, gas, npix * sizeof(uint32_t));
+    memcpy(wl, wall, npix * sizeof(uint32_t));
+    /* cells of each block: the last row and column may be partial */
+    for (i=0; i<H; i++) {
+        for (j=0; j<W; j++) {
+            const int hi = (pv->Ny - i*pv->f < pv->f) ? pv->Ny - i*pv->f : pv->f;
+            const int wj = (pv->Nx - j*pv->f < pv->f) ? pv->Nx - j*pv->f : pv->f;
+            c[(size_t)i*W + j] = (uint32_t)hi * wj;
+        }
+    }
+    w = W;
+    h = H;
+    for (;;) {
+        for (i=0; i<h; i++) {
+            for (j=0; j<w; j++) {
+                const size_t k = (size_t)i*W + j;
+                img[(size_t)(y0 + i) * width + x0 + j] = hpp_preview_shade(g[k], wl[k], c[k]);
+            }
+        }
+        if (w == 1 && h == 1) {
+            break;
+        }
+        /* next level in place: block (i,j) sums blocks 2i..2i+1, 2j..2j+1 */
+        {
+            const int nw = (w + 1) / 2, nh = (h + 1) / 2;
+            for (i=0; i<nh; i++) {
+                for (j=0; j<nw; j++) {
+                    uint32_t sg = 0, sw = 0, sc = 0;
+                    int di, dj;
+                    for (di=0; di<2 && 2*i+di<h; di++) {
+                        for (dj=0; dj<2 && 2*j+dj<w; dj++) {
+                            const size_t k = (size_t)(2*i+di)*W + 2*j+dj;
+                            sg += g[k]; sw += wl[k]; sc += c[k];
+                        }
+                    }
+                    g[(size_t)i*W + j] = sg;
+                    wl[(size_t)i*W + j] = sw;
+                    c[(size_t)i*W + j] = sc;
+                }
+            }
+            if (x0 == 0) {
+                x0 = W;
+            } else {
+                y0 += h;
+            }
+            w = nw;
+            h = nh;
+        }
+    }
+    free(g);
+    free(wl);
+    free(c);
+
+    if ((f = fopen(fname, "w")) == NULL) {
+        free(img);
+        return -1;
+    }
+    fprintf(f, "P5\n");
+    fprintf(f, "# produced by hpp (gas density mipmap, %d cells per pixel side)\n", pv->f);
+    fprintf(f, "%d %d\n", width, height);
+    fprintf(f, "255\n");
+    fwrite(img, 1, (size_t)width * height, f);
+    free(img);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Write the crop (cell values, as the full image); returns 0 on
+   success, -1 otherwise */
+static inline int hpp_preview_write_crop( const hpp_preview_t *pv, const unsigned char *crop,
+                                          int maxval, const char *fname )
+{
+    FILE *f;
+
+    if ((f = fopen(fname, "w")) == NULL) {
+        return -1;
+    }
+    fprintf(f, "P5\n");
+    fprintf(f, "# produced by hpp (crop at %d,%d)\n", pv->roi[0], pv->roi[1]);
+    fprintf(f, "%d %d\n", pv->roi[2], pv->roi[3]);
+    fprintf(f, "%d\n", maxval);
+    fwrite(crop, 1, (size_t)pv->roi[2] * pv->roi[3], f);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,217 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Live telemetry of a running simulation (--stats=name): the
+ ** simulators publish a few counters in a POSIX shared-memory segment
+ ** that hpp-top (or anything else that maps it) reads while the run
+ ** goes on. The segment holds a header followed by one slot per
+ ** process (per MPI rank, or the only process of omp-hpp); every slot
+ ** has exactly one writer, which updates it once per step with relaxed
+ ** atomic loads and stores, so no locks or read-modify-write
+ ** instructions are needed and the readers never slow the writer down.
+ ** Readers may see the fields of a slot from slightly different
+ ** instants, which is fine for monitoring.
+ **
+ ** Requires _POSIX_C_SOURCE >= 200112L before the system headers.
+ **/
+#ifndef HPP_STATS_H
+#define HPP_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HPP_STATS_MAGIC 0x53505048u /* "HPPS" */
+#define HPP_STATS_VERSION 1u
+
+typedef enum {
+    HPP_STATS_IDLE,     /* not started yet (or not simulating) */
+    HPP_STATS_STEP,     /* computing */
+    HPP_STATS_EXCHANGE, /* exchanging halos with the neighbours */
+    HPP_STATS_OUTPUT,   /* writing a frame */
+    HPP_STATS_DONE      /* finished */
+} hpp_stats_activity_t;
+
+typedef struct {
+    uint32_t magic;        /* written last: the segment is ready */
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t Nx;           /* columns of the domain */
+    uint64_t nsteps;       /* steps requested (2*S with DUMP_ALL) */
+    uint64_t start_ns;     /* CLOCK_MONOTONIC when the segment was created */
+    uint32_t Ny;           /* rows of the domain */
+    uint32_t unused;
+    uint64_t reserved[3];
+} hpp_stats_header_t;
+
+/* One slot per process, a multiple of the cache line so that the
+   writers of adjacent slots do not share lines; times are in ns */
+typedef struct {
+    uint64_t step;            /* steps completed */
+    uint64_t phase_ns[2];     /* time spent in the even and odd phase */
+    uint64_t exchange_ns;     /* time spent exchanging halos */
+    uint64_t bytes_exchanged; /* halo bytes received (messages or copies) */
+    uint64_t frames_written;
+    uint64_t heartbeat_ns;    /* CLOCK_MONOTONIC of the last update */
+    uint64_t activity;        /* hpp_stats_activity_t */
+    uint64_t pid;
+    uint64_t reserved[7];
+} hpp_stats_slot_t;
+
+typedef struct {
+    hpp_stats_header_t *hdr;
+    hpp_stats_slot_t *slots;
+    size_t size;
+} hpp_stats_t;
+
+static inline uint64_t hpp_stats_now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t hpp_stats_get( const uint64_t *p )
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void hpp_stats_set( uint64_t *p, uint64_t v )
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+/* Only the owner of the slot writes it, a load and a store suffice */
+static inline void hpp_stats_add( uint64_t *p, uint64_t v )
+{
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+/* Mark a step completed and refresh the heartbeat; `slot` may be NULL */
+static inline void hpp_stats_step( hpp_stats_slot_t *slot, uint64_t step )
+{
+    if (slot != NULL) {
+        hpp_stats_set(&slot->step, step);
+        hpp_stats_set(&slot->heartbeat_ns, hpp_stats_now());
+    }
+}
+
+/* Add `ns` to the time of `phase` (0 even, 1 odd); `slot` may be NULL */
+static inline void hpp_stats_phase( hpp_stats_slot_t *slot, int phase, uint64_t ns )
+{
+    if (slot != NULL) {
+        hpp_stats_add(&slot->phase_ns[phase], ns);
+    }
+}
+
+static inline void hpp_stats_activity( hpp_stats_slot_t *slot, hpp_stats_activity_t a )
+{
+    if (slot != NULL) {
+        hpp_stats_set(&slot->activity, (uint64_t)a);
+        hpp_stats_set(&slot->heartbeat_ns, hpp_stats_now());
+    }
+}
+
+/* POSIX shared-memory names start with a slash, add it if missing */
+static inline void hpp_stats_name( char *buf, size_t len, const char *name )
+{
+    snprintf(buf, len, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+static inline size_t hpp_stats_size( uint32_t nslots )
+{
+    return sizeof(hpp_stats_header_t) + (size_t)nslots * sizeof(hpp_stats_slot_t);
+}
+
+/* Create (or join, when several processes share it) the segment `name`
+   with `nslots` slots. Returns 0 on success, -1 with errno set
+   otherwise; the segment is zero-filled when first created. */
+static inline int hpp_stats_create( hpp_stats_t *st, const char *name, uint32_t nslots,
+                                    uint32_t Nx, uint32_t Ny, uint64_t nsteps )
+{
+    const size_t size = hpp_stats_size(nslots);
+    void *map;
+    int fd;
+
+    if ((fd = shm_open(name, O_CREAT | O_RDWR, 0644)) < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    st->hdr = (hpp_stats_header_t*)map;
+    st->slots = (hpp_stats_slot_t*)(st->hdr + 1);
+    st->size = size;
+    /* all the writers store the same values */
+    st->hdr->version = HPP_STATS_VERSION;
+    st->hdr->nslots = nslots;
+    st->hdr->Nx = Nx;
+    st->hdr->Ny = Ny;
+    st->hdr->nsteps = nsteps;
+    if (st->hdr->start_ns == 0) {
+        st->hdr->start_ns = hpp_stats_now();
+    }
+    __atomic_store_n(&st->hdr->magic, HPP_STATS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Map an existing segment read-only. Returns 0 on success, -1 with
+   errno set otherwise (EINVAL if it is not a valid stats segment). */
+static inline int hpp_stats_open( hpp_stats_t *st, const char *name )
+{
+    struct stat sb;
+    void *map;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)sb.st_size < sizeof(hpp_stats_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    st->hdr = (hpp_stats_header_t*)map;
+    st->slots = (hpp_stats_slot_t*)(st->hdr + 1);
+    st->size = (size_t)sb.st_size;
+    if (__atomic_load_n(&st->hdr->magic, __ATOMIC_ACQUIRE) != HPP_STATS_MAGIC ||
+        st->hdr->version != HPP_STATS_VERSION ||
+        hpp_stats_size(st->hdr->nslots) > st->size) {
+        munmap(map, st->size);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void hpp_stats_close( hpp_stats_t *st )
+{
+    munmap(st->hdr, st->size);
+    st->hdr = NULL;
+    st->slots = NULL;
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Live monitor of a simulation started with --stats=name (see
+ ** hpp-stats.h): it maps the telemetry segment read-only and prints,
+ ** every few seconds, the progress and the throughput of each process
+ ** over the last interval. It never writes to the segment, so it does
+ ** not interfere with the simulation.
+ **
+ ** Compile with:
+ **
+ **     gcc -std=c99 -Wall -Wpedantic -O2 hpp-top.c -o hpp-top -lrt
+ **
+ ** Run with:
+ **
+ **     ./hpp-top [--interval=seconds] [--once] name
+ **/
+#define _POSIX_C_SOURCE 200809L /* shm_open(), nanosleep() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "hpp-stats.h"
+
+static const char *activity_name[] = {"idle", "step", "exchange", "output", "done"};
+
+void sleep_seconds( double s )
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)s;
+    ts.tv_nsec = (long)((s - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/* Copy the slots with relaxed loads */
+void snapshot( const hpp_stats_t *st, hpp_stats_slot_t *copy )
+{
+    uint32_t k;
+
+    for (k=0; k<st->hdr->nslots; k++) {
+        const hpp_stats_slot_t *s = &st->slots[k];
+        hpp_stats_slot_t *c = &copy[k];
+        memset(c, 0, sizeof(*c));
+        c->step = hpp_stats_get(&s->step);
+        c->phase_ns[0] = hpp_stats_get(&s->phase_ns[0]);
+        c->phase_ns[1] = hpp_stats_get(&s->phase_ns[1]);
+        c->exchange_ns = hpp_stats_get(&s->exchange_ns);
+        c->bytes_exchanged = hpp_stats_get(&s->bytes_exchanged);
+        c->frames_written = hpp_stats_get(&s->frames_written);
+        c->heartbeat_ns = hpp_stats_get(&s->heartbeat_ns);
+        c->activity = hpp_stats_get(&s->activity);
+        c->pid = hpp_stats_get(&s->pid);
+    }
+}
+
+/* Print one line per process; returns the number still running */
+int report( const hpp_stats_t *st, const hpp_stats_slot_t *prev, const hpp_stats_slot_t *cur,
+            double interval, int clear )
+{
+    const uint64_t now = hpp_stats_now();
+    const uint64_t nsteps = st->hdr->nsteps;
+    int running = 0;
+    uint32_t k;
+
+    if (clear) {
+        printf("\033[H\033[2J");
+    }
+    printf("N=%ux%u, %llu steps, %u slots, %.1f s since start\n", st->hdr->Nx, st->hdr->Ny,
+           (unsigned long long)nsteps, st->hdr->nslots, (now - st->hdr->start_ns) * 1e-9);
+    printf("%4s %8s %17s %6s %9s %8s %8s %8s %9s %6s %9s %8s\n", "slot", "pid", "step", "%",
+           "steps/s", "even ms", "odd ms", "exch ms", "exch MB/s", "frames", "state", "beat");
+    for (k=0; k<st->hdr->nslots; k++) {
+        const hpp_stats_slot_t *p = &prev[k], *c = &cur[k];
+        const uint64_t dsteps = c->step - p->step;
+        const double age = (c->heartbeat_ns > 0 && now > c->heartbeat_ns) ?
+            (now - c->heartbeat_ns) * 1e-9 : 0.0;
+        const char *state = (c->activity <= HPP_STATS_DONE) ? activity_name[c->activity] : "?";
+
+        if (c->pid == 0) {
+            continue; /* not used (e.g. a rank on another node) */
+        }
+        if (c->activity != HPP_STATS_DONE) {
+            running++;
+        }
+        printf("%4u %8llu %8llu/%-8llu %6.1f %9.1f", k, (unsigned long long)c->pid,
+               (unsigned long long)c->step, (unsigned long long)nsteps,
+               nsteps > 0 ? 100.0 * c->step / nsteps : 0.0, dsteps / interval);
+        if (dsteps > 0) {
+            printf(" %8.3f %8.3f %8.3f", (c->phase_ns[0] - p->phase_ns[0]) * 1e-6 / dsteps,
+                   (c->phase_ns[1] - p->phase_ns[1]) * 1e-6 / dsteps,
+                   (c->exchange_ns - p->exchange_ns) * 1e-6 / dsteps);
+        } else {
+            printf(" %8s %8s %8s", "-", "-", "-");
+        }
+        printf(" %9.1f %6llu %9s %7.1fs%s\n",
+               (c->bytes_exchanged - p->bytes_exchanged) / interval * 1e-6,
+               (unsigned long long)c->frames_written, state, age,
+               /* no update for a while: stuck in `state` */
+               (c->activity != HPP_STATS_DONE && age > 5.0 * interval && age > 1.0) ?
+               " STALLED" : "");
+    }
+    fflush(stdout);
+    return running;
+}
+
+int main( int argc, char *argv[] )
+{
+    double interval = 1.0;
+    int once = 0, i, waiting = 0;
+    const char *name = NULL;
+    char shm_name[256];
+    hpp_stats_t st;
+    hpp_stats_slot_t *prev, *cur;
+
+    for (i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--interval=", 11) == 0) {
+            interval = atof(argv[i] + 11);
+        } else if (strcmp(argv[i], "--once") == 0) {
+            once = 1;
+        } else if (strncmp(argv[i], "--", 2) != 0 && name == NULL) {
+            name = argv[i];
+        } else {
+            name = NULL;
+            break;
+        }
+    }
+    if (name == NULL || interval <= 0.0) {
+        fprintf(stderr, "Usage: %s [--interval=seconds] [--once] name\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* the simulation may not have started yet */
+    hpp_stats_name(shm_name, sizeof(shm_name), name);
+    while (hpp_stats_open(&st, shm_name) != 0) {
+        if (once || (errno != ENOENT && errno != EINVAL)) {
+            fprintf(stderr, "FATAL: can not open the stats segment \"%s\": %s\n",
+                    shm_name, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        if (!waiting) {
+            fprintf(stderr, "Waiting for \"%s\"...\n", shm_name);
+            waiting = 1;
+        }
+        sleep_seconds(interval);
+    }
+
+    prev = (hpp_stats_slot_t*)malloc(st.hdr->nslots * sizeof(*prev));
+    assert(prev != NULL);
+    cur = (hpp_stats_slot_t*)malloc(st.hdr->nslots * sizeof(*cur));
+    assert(cur != NULL);
+    snapshot(&st, prev);
+    /* the segment stays mapped after the simulation removes it */
+    for (;;) {
+        sleep_seconds(interval);
+        snapshot(&st, cur);
+        if (report(&st, prev, cur, interval, !once && isatty(STDOUT_FILENO)) == 0 || once) {
+            break;
+        }
+        memcpy(prev, cur, st.hdr->nslots * sizeof(*prev));
+    }
+    free(prev);
+    free(cur);
+    hpp_stats_close(&st);
+    return EXIT_SUCCESS;
+}
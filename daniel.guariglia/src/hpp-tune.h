@@ -0,0 +1,138 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Per-host tuning cache (--autotune): the simulators time a few
+ ** configurations on the domain they are asked to run and remember the
+ ** fastest one in a small text file, one line per configuration key:
+ **
+ **     omp 4096x4096 rows 8 static 0 0.412
+ **     mpi 4096x4096 4 2 1 0.655
+ **
+ ** The key (the words before the values) names the program and the
+ ** problem; the values are parsed by the program that wrote them. Later
+ ** runs with the same key load the line at startup. The file is
+ ** $HPP_TUNE_FILE if set, otherwise tune-<hostname> in
+ ** $XDG_CACHE_HOME/hpp (default ~/.cache/hpp), since the best
+ ** configuration depends on the machine.
+ **
+ ** Requires _POSIX_C_SOURCE >= 200809L before the system headers.
+ **/
+#ifndef HPP_TUNE_H
+#define HPP_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HPP_TUNE_LINE 256
+
+/* Directory of the cache and path of the file of this host; returns 0
+   on success, -1 if the path does not fit or no directory is known */
+static inline int hpp_tune_path( char *dir, char *fname, size_t len )
+{
+    const char *file = getenv("HPP_TUNE_FILE");
+    const char *base = getenv("XDG_CACHE_HOME");
+    char host[64];
+    int n;
+
+    if (file != NULL && file[0] != '\0') {
+        dir[0] = '\0';
+        n = snprintf(fname, len, "%s", file);
+        return (n > 0 && (size_t)n < len) ? 0 : -1;
+    }
+    if (base != NULL && base[0] != '\0') {
+        n = snprintf(dir, len, "%s/hpp", base);
+    } else if ((base = getenv("HOME")) != NULL && base[0] != '\0') {
+        n = snprintf(dir, len, "%s/.cache/hpp", base);
+    } else {
+        return -1;
+    }
+    if (n < 0 || (size_t)n >= len) {
+        return -1;
+    }
+    if (gethostname(host, sizeof(host)) != 0) {
+        strcpy(host, "localhost");
+    }
+    host[sizeof(host) - 1] = '\0';
+    n = snprintf(fname, len, "%s/tune-%s", dir, host);
+    return (n > 0 && (size_t)n < len) ? 0 : -1;
+}
+
+/* Copy into `value` the values stored for `key`; returns 0 if found */
+static inline int hpp_tune_lookup( const char *key, char *value, size_t len )
+{
+    char dir[512], fname[512], line[HPP_TUNE_LINE];
+    const size_t klen = strlen(key);
+    int found = -1;
+    FILE *f;
+
+    if (hpp_tune_path(dir, fname, sizeof(fname)) != 0 || (f = fopen(fname, "r")) == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, klen) == 0 && line[klen] == ' ') {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(value, len, "%s", line + klen + 1);
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/* Replace (or add) the line of `key`. The file is rewritten to a
+   temporary and renamed, so that concurrent runs never read half a
+   file; returns 0 on success, -1 otherwise */
+static inline int hpp_tune_store( const char *key, const char *value )
+{
+    char dir[512], fname[512], tmpname[528], line[HPP_TUNE_LINE];
+    const size_t klen = strlen(key);
+    FILE *in, *out;
+    int fd;
+
+    if (hpp_tune_path(dir, fname, sizeof(fname)) != 0) {
+        return -1;
+    }
+    if (dir[0] != '\0') {
+        /* the parent (e.g. ~/.cache) may not exist yet either */
+        char *slash = strrchr(dir, '/');
+        if (slash != NULL && slash != dir) {
+            *slash = '\0';
+            mkdir(dir, 0755);
+            *slash = '/';
+        }
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    snprintf(tmpname, sizeof(tmpname), "%s.XXXXXX", fname);
+    if ((fd = mkstemp(tmpname)) < 0) {
+        return -1;
+    }
+    if ((out = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        unlink(tmpname);
+        return -1;
+    }
+    if ((in = fopen(fname, "r")) != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (!(strncmp(line, key, klen) == 0 && line[klen] == ' ')) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %s\n", key, value);
+    if (fclose(out) != 0 || chmod(tmpname, 0644) != 0 || rename(tmpname, fname) != 0) {
+        unlink(tmpname);
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** Decoder of the frame streams written with --delta=k (see
+ ** hpp-delta.h): rebuilds frames first..last (all of them by default)
+ ** as PGM images named "<prefix>NNNNN.pgm", the same files that the
+ ** simulators write without --delta.
+ **
+ ** Compile with:
+ **
+ **     gcc -std=c99 -Wall -Wpedantic -O2 -fopenmp hpp-undelta.c -o hpp-undelta
+ **
+ ** Run with:
+ **
+ **     ./hpp-undelta [--prefix=name] stream [first [last]]
+ **/
+#define _POSIX_C_SOURCE 200809L /* fseeko(), ftello() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "hpp-delta.h"
+
+void write_pgm( const unsigned char *frame, uint32_t Nx, uint32_t Ny, const char *prefix,
+                uint32_t frameno )
+{
+    FILE *f;
+    char fname[128];
+
+    snprintf(fname, sizeof(fname), "%s%05u.pgm", prefix, frameno);
+    if ((f = fopen(fname, "w")) == NULL) {
+        fprintf(stderr, "FATAL: can not open \"%s\" for writing\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "P5\n");
+    fprintf(f, "# produced by hpp\n");
+    fprintf(f, "%u %u\n", Nx, Ny);
+    fprintf(f, "%d\n", HPP_DELTA_EMPTY); /* highest shade of grey (0=black) */
+    fwrite(frame, 1, (size_t)Nx*Ny, f);
+    fclose(f);
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *prefix = "hpp";
+    hpp_delta_reader_t r;
+    unsigned char *frame;
+    uint32_t first = 0, last = UINT32_MAX, f, got;
+    int i, n = 0;
+    char *pos[3];
+
+    for (i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--prefix=", 9) == 0) {
+            prefix = argv[i] + 9;
+        } else if (strncmp(argv[i], "--", 2) != 0 && n < 3) {
+            pos[n++] = argv[i];
+        } else {
+            n = 0;
+            break;
+        }
+    }
+    if (n < 1) {
+        fprintf(stderr, "Usage: %s [--prefix=name] stream [first [last]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (n > 1) {
+        first = (uint32_t)strtoul(pos[1], NULL, 10);
+        last = first;
+    }
+    if (n > 2) {
+        last = (uint32_t)strtoul(pos[2], NULL, 10);
+    }
+    if (hpp_delta_read_open(&r, pos[0]) != 0) {
+        fprintf(stderr, "FATAL: \"%s\" is not a readable frame stream\n", pos[0]);
+        return EXIT_FAILURE;
+    }
+    frame = (unsigned char*)malloc((size_t)r.Nx * r.Ny);
+    assert(frame != NULL);
+
+    if (hpp_delta_read_frame(&r, first, frame) != 0) {
+        fprintf(stderr, "FATAL: frame %u not found in \"%s\"\n", first, pos[0]);
+        return EXIT_FAILURE;
+    }
+    write_pgm(frame, r.Nx, r.Ny, prefix, first);
+    for (f=first+1; f<=last && f>first; f++) {
+        if (hpp_delta_read_next(&r, frame, &got) != 0 || got != f) {
+            if (last != UINT32_MAX) {
+                fprintf(stderr, "FATAL: frame %u not found in \"%s\"\n", f, pos[0]);
+                return EXIT_FAILURE;
+            }
+            break; /* end of the stream */
+        }
+        write_pgm(frame, r.Nx, r.Ny, prefix, f);
+    }
+    printf("%u frames of %ux%u decoded\n", f - first, r.Nx, r.Ny);
+    hpp_delta_read_close(&r);
+    free(frame);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** libhpp: the OpenMP simulator as a library, for programs that run
+ ** many short simulations without starting a process for each one.
+ **
+ **     hpp_sim_t *sim = hpp_create(512, NULL, NULL);
+ **     if (hpp_load(sim, "cannon.in", 1234) != HPP_OK) ...
+ **     hpp_step(sim, 100);
+ **     const unsigned char *grid = hpp_grid(sim);   (N*N cells, row-major)
+ **     hpp_reverse(sim, 100);                       (back to the start)
+ **     hpp_destroy(sim);
+ **
+ ** The grid is read and written in place: a caller that passes its own
+ ** buffers to hpp_create() (e.g. two N*N uint8 numpy arrays) sees the
+ ** current state in the first one after every call, without copies.
+ ** The OpenMP threads are started by hpp_create() and stay alive
+ ** between calls. A simulation must not be used by two threads at once;
+ ** hpp_load() uses rand(), so loads should not run concurrently either.
+ **
+ ** Build with "make lib" (libhpp.so) and link with -lhpp.
+ **/
+#ifndef HPP_H
+#define HPP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* values of the cells */
+#define HPP_WALL 0
+#define HPP_GAS 1
+#define HPP_EMPTY 2
+
+/* status codes */
+#define HPP_OK 0
+#define HPP_ERR_ARG -1      /* invalid argument */
+#define HPP_ERR_IO -2       /* file can not be opened or written */
+#define HPP_ERR_INPUT -3    /* unknown or malformed command in the input */
+
+typedef struct hpp_sim hpp_sim_t;
+
+/* Create a simulation on a N*N grid (N even). `cur` and `next` are
+   either both NULL (the library allocates them) or two buffers of N*N
+   bytes owned by the caller, that must outlive the simulation; the
+   state is always in `cur`. Returns NULL if N is invalid or memory is
+   exhausted. The grid starts EMPTY. */
+hpp_sim_t *hpp_create( int N, unsigned char *cur, unsigned char *next );
+
+/* Draw the scenario of the input file `fname` (same format as omp-hpp)
+   after srand(seed) */
+int hpp_load( hpp_sim_t *sim, const char *fname, unsigned seed );
+
+/* Advance by n steps, or undo n steps */
+int hpp_step( hpp_sim_t *sim, int n );
+int hpp_reverse( hpp_sim_t *sim, int n );
+
+/* Current grid (N*N cells, row-major) and its side */
+unsigned char *hpp_grid( hpp_sim_t *sim );
+int hpp_size( const hpp_sim_t *sim );
+
+/* Write the current grid as a PGM image, as omp-hpp does */
+int hpp_write_image( const hpp_sim_t *sim, const char *fname );
+
+/* Number of OpenMP threads used by the calling thread (0 = default) */
+void hpp_set_threads( int nthreads );
+
+void hpp_destroy( hpp_sim_t *sim );
+
+/* Message of a status code */
+const char *hpp_strerror( int status );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/*
+* Author: Guariglia Daniel 0000916433
+*
+*/
+/**
+ ** libhpp (see hpp.h): omp-hpp.c compiled without main() plus the
+ ** exported API. Build with
+ **
+ **     gcc -std=c99 -Wall -Wpedantic -O2 -fopenmp -fPIC -fvisibility=hidden \
+ **         -shared libhpp.c -o libhpp.so -lm -lrt
+ **
+ ** so that only the hpp_* functions below are visible.
+ **/
+#define HPP_LIBRARY
+#include "omp-hpp.c"
+#include "hpp.h"
+
+#define HPP_API __attribute__((visibility("default")))
+
+struct hpp_sim {
+    int N;
+    cell_t *cur, *next;
+    int owned;          /* the buffers were allocated by hpp_create() */
+};
+
+HPP_API hpp_sim_t *hpp_create( int N, unsigned char *cur, unsigned char *next )
+{
+    hpp_sim_t *sim;
+
+    if (N <= 0 || N % 2 != 0 || (cur == NULL) != (next == NULL))
+        return NULL;
+    if ((sim = (hpp_sim_t*)malloc(sizeof(*sim))) == NULL)
+        return NULL;
+    sim->N = N;
+    sim->owned = (cur == NULL);
+    if (sim->owned) {
+        cur = (cell_t*)malloc((size_t)N*N);
+        next = (cell_t*)malloc((size_t)N*N);
+        if (cur == NULL || next == NULL) {
+            free(cur);
+            free(next);
+            free(sim);
+            return NULL;
+        }
+    }
+    sim->cur = cur;
+    sim->next = next;
+    memset(sim->cur, EMPTY, (size_t)N*N);
+    /* start the threads now, the runtime keeps them for the next calls */
+    #pragma omp parallel
+    {
+    }
+    return sim;
+}
+
+HPP_API int hpp_load( hpp_sim_t *sim, const char *fname, unsigned seed )
+{
+    FILE *filein;
+    int op;
+
+    if (sim == NULL || fname == NULL)
+        return HPP_ERR_ARG;
+    if ((filein = fopen(fname, "r")) == NULL)
+        return HPP_ERR_IO;
+    srand(seed);
+    op = read_problem(filein, sim->cur, sim->N, sim->N);
+    fclose(filein);
+    return (op == 0) ? HPP_OK : HPP_ERR_INPUT;
+}
+
+HPP_API int hpp_step( hpp_sim_t *sim, int n )
+{
+    int t;
+
+    if (sim == NULL || n < 0)
+        return HPP_ERR_ARG;
+    for (t=0; t<n; t++) {
+        step(sim->cur, sim->next, sim->N, sim->N, EVEN_PHASE);
+        step(sim->next, sim->cur, sim->N, sim->N, ODD_PHASE);
+    }
+    return HPP_OK;
+}
+
+HPP_API int hpp_reverse( hpp_sim_t *sim, int n )
+{
+    int t;
+
+    if (sim == NULL || n < 0)
+        return HPP_ERR_ARG;
+    for (t=0; t<n; t++) {
+        step(sim->cur, sim->next, sim->N, sim->N, ODD_PHASE);
+        step(sim->next, sim->cur, sim->N, sim->N, EVEN_PHASE);
+    }
+    return HPP_OK;
+}
+
+HPP_API unsigned char *hpp_grid( hpp_sim_t *sim )
+{
+    return (sim != NULL) ? sim->cur : NULL;
+}
+
+HPP_API int hpp_size( const hpp_sim_t *sim )
+{
+    return (sim != NULL) ? sim->N : 0;
+}
+
+HPP_API int hpp_write_image( const hpp_sim_t *sim, const char *fname )
+{
+    if (sim == NULL || fname == NULL)
+        return HPP_ERR_ARG;
+    return (write_pgm(sim->cur, sim->N, sim->N, fname) == 0) ? HPP_OK : HPP_ERR_IO;
+}
+
+HPP_API void hpp_set_threads( int nthreads )
+{
+    if (nthreads > 0)
+        omp_set_num_threads(nthreads);
+}
+
+HPP_API void hpp_destroy( hpp_sim_t *sim )
+{
+    if (sim == NULL)
+        return;
+    if (sim->owned) {
+        free(sim->cur);
+        free(sim->next);
+    }
+    free(sim);
+}
+
+HPP_API const char *hpp_strerror( int status )
+{
+    switch (status) {
+    case HPP_OK: return "success";
+    case HPP_ERR_ARG: return "invalid argument";
+    case HPP_ERR_IO: return "can not open or write the file";
+    case HPP_ERR_INPUT: return "unknown or malformed command in the input";
+    default: return "unknown error";
+    }
+}
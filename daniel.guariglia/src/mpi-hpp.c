@@ -2,12 +2,26 @@
 * Author: Guariglia Daniel 0000916433
 * 
 */
+#define _POSIX_C_SOURCE 200809L /* mmap(), mkstemp(), fsync() */
+#define _DEFAULT_SOURCE         /* MAP_ANONYMOUS, madvise(), syscall() */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <math.h> /* for ceil() */
 #include <assert.h>
 #include <time.h>
 #include <mpi.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hpp-stats.h"
+#include "hpp-delta.h"
+#include "hpp-preview.h"
+#include "hpp-tune.h"
+#include "hpp-alloc.h"
+#include "hpp-cache.h"
 
 typedef enum
 {
@@ -25,13 +39,31 @@ typedef enum
 /* type of a cell of the domain */
 typedef unsigned char cell_t;
 
-/* Simplifies indexing on a N*N grid */
-int IDX(int i, int j, int N)
+/* slot di telemetria di questo processo (NULL senza --stats) */
+static hpp_stats_slot_t *stats = NULL;
+
+/* flusso dei frame di --delta (NULL se i frame sono scritti come PGM) */
+static hpp_delta_writer_t *delta = NULL;
+
+/* anteprime scritte al posto dei frame (NULL senza --preview/--roi) */
+static hpp_preview_t *preview = NULL;
+
+/* Simplifies indexing on a grid of Ny rows of Nx cells; the linear
+   index is 64-bit since Nx*Ny overflows an int past 2^31 cells */
+size_t IDX(int i, int j, int Nx, int Ny)
 {
     /* wrap-around */
-    i = (i + N) % N;
-    j = (j + N) % N;
-    return i * N + j;
+    i = (i + Ny) % Ny;
+    j = (j + Nx) % Nx;
+    return (size_t)i * Nx + j;
+}
+
+/* Indexing on a local slab of rows: only columns wrap around, the
+   vertical neighbours of the slab are provided by the halo rows */
+size_t ROW_IDX(int i, int j, int Ncol)
+{
+    j = (j + Ncol) % Ncol;
+    return (size_t)i * Ncol + j;
 }
 
 /* Swap the content of cells a and b, provided that neither is a WALL;
@@ -46,8 +78,12 @@ void swap_cells(cell_t *a, cell_t *b)
     }
 }
 
-/* Compute the `next` grid given the `cur`-rent configuration. */
-void step(const cell_t *cur, cell_t *next, int Nrow, int Ncol, phase_t phase, int my_rank)
+/* Compute the `next` grid given the `cur`-rent configuration. Se
+   transposed != 0 le righe del buffer sono le colonne del dominio: il
+   vicino orizzontale di a diventa quello verticale e viceversa, per cui
+   b e c vengono scambiati (la regola non e' simmetrica rispetto alla
+   trasposizione). */
+void step(const cell_t *cur, cell_t *next, int Nrow, int Ncol, phase_t phase, int transposed)
 {
     int i, j;
 
@@ -68,17 +104,17 @@ void step(const cell_t *cur, cell_t *next, int Nrow, int Ncol, phase_t phase, in
              * dc
              * ba
              */
-            int a = 0;
-            int b = 0;
-            int c = 0;
-            int d = 0;
+            size_t a = 0;
+            size_t b = 0;
+            size_t c = 0;
+            size_t d = 0;
             // se è la fase pari calcolo gli indici "nel modo classico"
             if (phase == EVEN_PHASE)
             {
-                a = IDX(i, j, Ncol);
-                b = IDX(i, j + phase, Ncol);
-                c = IDX(i + phase, j, Ncol);
-                d = IDX(i + phase, j + phase, Ncol);
+                a = ROW_IDX(i, j, Ncol);
+                b = ROW_IDX(i, j + phase, Ncol);
+                c = ROW_IDX(i + phase, j, Ncol);
+                d = ROW_IDX(i + phase, j + phase, Ncol);
             }
 
             // se la fase è dispari calcolo gli indici in modo diverso
@@ -88,19 +124,25 @@ void step(const cell_t *cur, cell_t *next, int Nrow, int Ncol, phase_t phase, in
                 // se sto considerando la prima colonna calcolo gli indici considerando il wrap
                 if (j == 0)
                 {
-                    a = IDX(i + 1, j, Ncol);
-                    b = IDX(i + 1, j + phase, Ncol);
-                    c = IDX(i, j, Ncol);
-                    d = IDX(i, j + phase, Ncol);
+                    a = ROW_IDX(i + 1, j, Ncol);
+                    b = ROW_IDX(i + 1, j + phase, Ncol);
+                    c = ROW_IDX(i, j, Ncol);
+                    d = ROW_IDX(i, j + phase, Ncol);
                 }
                 else
                 {
-                    a = IDX(i + 1, j, Ncol);
-                    b = IDX(i + 1, j + phase, Ncol);
-                    c = IDX(i, j, Ncol);
-                    d = IDX(i, j + phase, Ncol);
+                    a = ROW_IDX(i + 1, j, Ncol);
+                    b = ROW_IDX(i + 1, j + phase, Ncol);
+                    c = ROW_IDX(i, j, Ncol);
+                    d = ROW_IDX(i, j + phase, Ncol);
                 }
             }
+            if (transposed)
+            {
+                const size_t tmp = b;
+                b = c;
+                c = tmp;
+            }
             next[a] = cur[a];
             next[b] = cur[b];
             next[c] = cur[c];
@@ -125,73 +167,75 @@ void step(const cell_t *cur, cell_t *next, int Nrow, int Ncol, phase_t phase, in
 /**
  ** The functions below are used to draw onto the grid; since they are
  ** called during initialization only, they do not need to be
- ** parallelized.
+ ** parallelized. Coordinates are fractions of the width (x) and of the
+ ** height (y) of the domain; the radius of a circle is a fraction of
+ ** the shorter side, so that circles stay round.
  **/
-void box(cell_t *grid, int N, float x1, float y1, float x2, float y2, cell_value_t t)
+void box(cell_t *grid, int Nx, int Ny, float x1, float y1, float x2, float y2, cell_value_t t)
 {
-    const int ix1 = ceil(fminf(x1, x2) * N);
-    const int ix2 = ceil(fmaxf(x1, x2) * N);
-    const int iy1 = ceil(fminf(y1, y1) * N);
-    const int iy2 = ceil(fmaxf(y1, y2) * N);
+    const int ix1 = ceil(fminf(x1, x2) * Nx);
+    const int ix2 = ceil(fmaxf(x1, x2) * Nx);
+    const int iy1 = ceil(fminf(y1, y1) * Ny);
+    const int iy2 = ceil(fmaxf(y1, y2) * Ny);
     int i, j;
     for (i = iy1; i <= iy2; i++)
     {
         for (j = ix1; j <= ix2; j++)
         {
-            const int ij = IDX(N - 1 - i, j, N);
+            const size_t ij = IDX(Ny - 1 - i, j, Nx, Ny);
             grid[ij] = t;
         }
     }
 }
 
-void circle(cell_t *grid, int N, float x, float y, float r, cell_value_t t)
+void circle(cell_t *grid, int Nx, int Ny, float x, float y, float r, cell_value_t t)
 {
-    const int ix = ceil(x * N);
-    const int iy = ceil(y * N);
-    const int ir = ceil(r * N);
+    const int ix = ceil(x * Nx);
+    const int iy = ceil(y * Ny);
+    const int ir = ceil(r * (Nx < Ny ? Nx : Ny));
     int dx, dy;
     for (dy = -ir; dy <= ir; dy++)
     {
         for (dx = -ir; dx <= ir; dx++)
         {
-            if (dx * dx + dy * dy <= ir * ir)
+            if ((long long)dx * dx + (long long)dy * dy <= (long long)ir * ir)
             {
-                const int ij = IDX(N - 1 - iy - dy, ix + dx, N);
+                const size_t ij = IDX(Ny - 1 - iy - dy, ix + dx, Nx, Ny);
                 grid[ij] = t;
             }
         }
     }
 }
 
-void random_fill(cell_t *grid, int N, float x1, float y1, float x2, float y2, float p)
+void random_fill(cell_t *grid, int Nx, int Ny, float x1, float y1, float x2, float y2, float p)
 {
-    const int ix1 = ceil(fminf(x1, x2) * N);
-    const int ix2 = ceil(fmaxf(x1, x2) * N);
-    const int iy1 = ceil(fminf(y1, y1) * N);
-    const int iy2 = ceil(fmaxf(y1, y2) * N);
+    const int ix1 = ceil(fminf(x1, x2) * Nx);
+    const int ix2 = ceil(fmaxf(x1, x2) * Nx);
+    const int iy1 = ceil(fminf(y1, y1) * Ny);
+    const int iy2 = ceil(fmaxf(y1, y2) * Ny);
     int i, j;
     for (i = iy1; i <= iy2; i++)
     {
         for (j = ix1; j <= ix2; j++)
         {
-            const int ij = IDX(N - 1 - i, j, N);
+            const size_t ij = IDX(Ny - 1 - i, j, Nx, Ny);
             if (grid[ij] == EMPTY && ((float)rand()) / RAND_MAX < p)
                 grid[ij] = GAS;
         }
     }
 }
 
-void read_problem(FILE *filein, cell_t *grid, int N)
+void read_problem(FILE *filein, cell_t *grid, int Nx, int Ny)
 {
     int i, j;
     int nread;
     char op;
 
-    for (i = 0; i < N; i++)
+    for (i = 0; i < Ny; i++)
     {
-        for (j = 0; j < N; j++)
+        for (j = 0; j < Nx; j++)
         {
-            const int ij = IDX(i, j, N);
+            const size_t ij = IDX(i, j, Nx, Ny);
             grid[ij] = EMPTY;
         }
     }
@@ -207,17 +251,17 @@ void read_problem(FILE *filein, cell_t *grid, int N)
         case 'c': /* circle */
             retval = fscanf(filein, "%f %f %f %d", &x1, &y1, &r, &t);
             assert(retval == 4);
-            circle(grid, N, x1, y1, r, t);
+            circle(grid, Nx, Ny, x1, y1, r, t);
             break;
         case 'b': /* box */
             retval = fscanf(filein, "%f %f %f %f %d", &x1, &y1, &x2, &y2, &t);
             assert(retval == 5);
-            box(grid, N, x1, y1, x2, y2, t);
+            box(grid, Nx, Ny, x1, y1, x2, y2, t);
             break;
         case 'r': /* random_fill */
             retval = fscanf(filein, "%f %f %f %f %f", &x1, &y1, &x2, &y2, &p);
             assert(retval == 5);
-            random_fill(grid, N, x1, y1, x2, y2, p);
+            random_fill(grid, Nx, Ny, x1, y1, x2, y2, p);
             break;
         default:
             fprintf(stderr, "FATAL: Unrecognized command `%c`\n", op);
@@ -226,367 +270,690 @@ void read_problem(FILE *filein, cell_t *grid, int N)
     }
 }
 
+/* Initialize `grid` from `filein` after seeding the PRNG with `seed`,
+   going through the scenario cache if `cache_dir` is not NULL */
+void load_problem(FILE *filein, cell_t *grid, int Nx, int Ny, unsigned seed, const char *cache_dir)
+{
+    hpp_cache_key_t key;
+
+    if (cache_dir != NULL)
+    {
+        hpp_cache_key(&key, filein, Nx, Ny, seed);
+        if (hpp_cache_load(cache_dir, &key, grid) == 0)
+            return;
+    }
+    srand(seed);
+    read_problem(filein, grid, Nx, Ny);
+    if (cache_dir != NULL)
+        hpp_cache_store(cache_dir, &key, grid);
+}
+
+
 /* Write an image of `grid` to a file in PGM (Portable Graymap)
    format. `frameno` is the time step number, used for labeling the
-   output file. */
-void write_image(const cell_t *grid, int N, int frameno)
+   output file, whose name is `prefix` followed by the frame number. */
+void write_image_named(const cell_t *grid, int Nx, int Ny, const char *prefix, int frameno)
 {
     FILE *f;
     char fname[128];
 
-    snprintf(fname, sizeof(fname), "hpp%05d.pgm", frameno);
-    if ((f = fopen(fname, "w")) == NULL)
+    hpp_stats_activity(stats, HPP_STATS_OUTPUT);
+    if (delta != NULL)
     {
-        printf("Cannot open \"%s\" for writing\n", fname);
-        abort();
+        hpp_delta_write(delta, grid);
     }
-    fprintf(f, "P5\n");
-    fprintf(f, "# produced by hpp\n");
-    fprintf(f, "%d %d\n", N, N);
-    fprintf(f, "%d\n", EMPTY); /* highest shade of grey (0=black) */
-    fwrite(grid, 1, N * N, f);
-    fclose(f);
+    else
+    {
+        snprintf(fname, sizeof(fname), "%s%05d.pgm", prefix, frameno);
+        if ((f = fopen(fname, "w")) == NULL)
+        {
+            printf("Cannot open \"%s\" for writing\n", fname);
+            abort();
+        }
+        fprintf(f, "P5\n");
+        fprintf(f, "# produced by hpp\n");
+        fprintf(f, "%d %d\n", Nx, Ny);
+        fprintf(f, "%d\n", EMPTY); /* highest shade of grey (0=black) */
+        fwrite(grid, 1, (size_t)Nx * Ny, f);
+        fclose(f);
+    }
+    if (stats != NULL)
+    {
+        hpp_stats_add(&stats->frames_written, 1);
+    }
+    hpp_stats_activity(stats, HPP_STATS_STEP);
 }
-void invert_row_for_EVEN(cell_t *my_next, int *sendcnts, int N, int comm_sz, int my_rank)
+
+void write_image(const cell_t *grid, int Nx, int Ny, int frameno)
 {
-    // scambio delle ghost cells
-    // i processi di indice pari inviano al thread di indice più piccolo la loro prima riga
-    if (my_rank == 0)
+    write_image_named(grid, Nx, Ny, "hpp", frameno);
+}
+
+/* Copia in dst (ncols righe di nrows celle) la trasposta di src (nrows
+   righe di ncols celle), a blocchi per restare in cache */
+void transpose(const cell_t *src, cell_t *dst, int nrows, int ncols)
+{
+    const int B = 64;
+    int i0, j0, i, j;
+
+    for (i0 = 0; i0 < nrows; i0 += B)
     {
-        // invio al processo di rank 1 l'ultima riga
-        // ricevo dall'ultimo la nuova prima riga
-        MPI_Send(
-            &my_next[sendcnts[my_rank] * 2 * N], // buf
-            N,                                   // count
-            MPI_UNSIGNED_CHAR,                   // data type
-            1,                                   // dest
-            0,                                   // tag
-            MPI_COMM_WORLD);
-
-        MPI_Recv(
-            my_next,           // buf
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            comm_sz - 1,       // source
-            MPI_ANY_TAG,       // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
+        for (j0 = 0; j0 < ncols; j0 += B)
+        {
+            for (i = i0; i < i0 + B && i < nrows; i++)
+            {
+                for (j = j0; j < j0 + B && j < ncols; j++)
+                {
+                    dst[(size_t)j * nrows + i] = src[(size_t)i * ncols + j];
+                }
+            }
+        }
     }
-    if (my_rank == comm_sz - 1)
-    {
-        // ricevo dal processo comm_sz -2 la nuova prima riga
-        // invio al processo 0 l'ultima
-        MPI_Recv(
-            my_next,           // buf
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            my_rank - 1,       // source
-            MPI_ANY_TAG,       // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
+}
 
-        MPI_Send(
-            &my_next[sendcnts[my_rank] * 2 * N], // buf
-            N,                                   // count
-            MPI_UNSIGNED_CHAR,                   // data type
-            0,                                   // dest
-            0,                                   // tag
-            MPI_COMM_WORLD);
-    }
-    if (my_rank > 0 && my_rank < comm_sz - 1)
-    {
-        if (my_rank % 2 == 0)
-        {
-            // invio a my_rank +1 l'ultima riga
-            // ricevo da my_rank -1 la prima
-            MPI_Send(
-                &my_next[sendcnts[my_rank] * 2 * N], // buf
-                N,                                   // count
-                MPI_UNSIGNED_CHAR,                   // data type
-                my_rank + 1,                         // dest
-                0,                                   // tag
-                MPI_COMM_WORLD);
-
-            MPI_Recv(
-                my_next,           // buf
-                N,                 // count
-                MPI_UNSIGNED_CHAR, // data type
-                my_rank - 1,       // source
-                MPI_ANY_TAG,       // tag
-                MPI_COMM_WORLD,
-                MPI_STATUS_IGNORE // status
-            );
-        }
-        if (my_rank % 2 == 1)
-        {
-            // ricevo da my_rank -1 la prima
-            // invio a my_rank +1 l'ultima
-            MPI_Recv(
-                my_next,           // buf
-                N,                 // count
-                MPI_UNSIGNED_CHAR, // data type
-                my_rank - 1,       // source
-                MPI_ANY_TAG,       // tag
-                MPI_COMM_WORLD,
-                MPI_STATUS_IGNORE // status
-            );
-
-            MPI_Send(
-                &my_next[sendcnts[my_rank] * 2 * N], // buf
-                N,                                   // count
-                MPI_UNSIGNED_CHAR,                   // data type
-                my_rank + 1,                         // dest
-                0,                                   // tag
-                MPI_COMM_WORLD);
-        }
-    }
-}
-
-void invert_row_for_ODD(cell_t *my_next, int *sendcnts, int N, int comm_sz, int my_rank)
-{
-    // scambio delle righe
-    // i processi di indice pari inviano al thread di indice più piccolo la loro prima riga
-    // successivamente ricevono una riga in ultima posizione 
-    if (my_rank == 0)
+/**
+ * Scrive la mipmap e il ritaglio di --preview e --roi senza raccogliere
+ * il dominio: ogni processo di comm conta le own_rows righe che possiede
+ * (a partire dalla riga globale row0 del buffer, una colonna del dominio
+ * se e' memorizzato trasposto), i conteggi e il ritaglio vengono sommati
+ * sul processo 0 che scrive le immagini.
+ */
+void write_preview(const cell_t *own, int row0, int own_rows, const char *prefix, int frameno,
+                   MPI_Comm comm)
+{
+    char fname[128];
+    int my_rank;
+
+    MPI_Comm_rank(comm, &my_rank);
+    hpp_stats_activity(stats, HPP_STATS_OUTPUT);
+    if (preview->max_side > 0)
     {
-        // invio al ultimo processo
-        // ricevo dall'uno
-        MPI_Send(
-            my_next,           // buf
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            comm_sz - 1,       // dest
-            0,                 // tag
-            MPI_COMM_WORLD);
-
-        MPI_Recv(
-            &my_next[sendcnts[my_rank] * 2 * N], // buf
-            N,                                   // count
-            MPI_UNSIGNED_CHAR,                   // data type
-            1,                                   // source
-            MPI_ANY_TAG,                         // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
+        const size_t npix = (size_t)preview->W * preview->H;
+        // conteggi del gas, poi dei muri
+        uint32_t *cnt = (uint32_t *)calloc(2 * npix, sizeof(uint32_t));
+        uint32_t *sum = (my_rank == 0) ? (uint32_t *)malloc(2 * npix * sizeof(uint32_t)) : NULL;
+        assert(cnt != NULL);
+        hpp_preview_count(preview, own, row0, own_rows, cnt, cnt + npix);
+        MPI_Reduce(cnt, sum, (int)(2 * npix), MPI_UINT32_T, MPI_SUM, 0, comm);
+        if (my_rank == 0)
+        {
+            snprintf(fname, sizeof(fname), "%s-preview%05d.pgm", prefix, frameno);
+            if (hpp_preview_write(preview, sum, sum + npix, fname) != 0)
+            {
+                printf("Cannot open \"%s\" for writing\n", fname);
+                abort();
+            }
+        }
+        free(cnt);
+        free(sum);
     }
-    if (my_rank == comm_sz - 1)
-    {
-        // ricevo dal processo 0
-        // invio al processo comm_sz -2
-        MPI_Recv(
-            &my_next[sendcnts[my_rank] * 2 * N], // buf
-            N,                                   // count
-            MPI_UNSIGNED_CHAR,                   // data type
-            0,                                   // source
-            MPI_ANY_TAG,                         // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
+    if (preview->roi[2] > 0)
+    {
+        // ogni cella del ritaglio appartiene a un solo processo
+        const size_t ncells = (size_t)preview->roi[2] * preview->roi[3];
+        cell_t *crop = (cell_t *)calloc(ncells, 1);
+        cell_t *sum = (my_rank == 0) ? (cell_t *)malloc(ncells) : NULL;
+        assert(crop != NULL);
+        hpp_preview_crop(preview, own, row0, own_rows, crop);
+        MPI_Reduce(crop, sum, (int)ncells, MPI_UNSIGNED_CHAR, MPI_SUM, 0, comm);
+        if (my_rank == 0)
+        {
+            snprintf(fname, sizeof(fname), "%s-roi%05d.pgm", prefix, frameno);
+            if (hpp_preview_write_crop(preview, sum, EMPTY, fname) != 0)
+            {
+                printf("Cannot open \"%s\" for writing\n", fname);
+                abort();
+            }
+        }
+        free(crop);
+        free(sum);
+    }
+    if (stats != NULL && my_rank == 0)
+    {
+        hpp_stats_add(&stats->frames_written, 1);
+    }
+    hpp_stats_activity(stats, HPP_STATS_STEP);
+}
 
-        MPI_Send(
-            my_next,           // buf
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            my_rank - 1,       // dest
-            0,                 // tag
-            MPI_COMM_WORLD);
-    }
-    if (my_rank > 0 && my_rank < comm_sz - 1)
-    {
-        if (my_rank % 2 == 0)
-        {
-            // invio a my_rank -1
-            // ricevo da my_rank +1
-            MPI_Send(
-                my_next,           // buf
-                N,                 // count
-                MPI_UNSIGNED_CHAR, // data type
-                my_rank - 1,       // dest
-                0,                 // tag
-                MPI_COMM_WORLD);
-
-            MPI_Recv(
-                &my_next[sendcnts[my_rank] * 2 * N], // buf
-                N,                                   // count
-                MPI_UNSIGNED_CHAR,                   // data type
-                my_rank + 1,                         // source
-                MPI_ANY_TAG,                         // tag
-                MPI_COMM_WORLD,
-                MPI_STATUS_IGNORE // status
-            );
-        }
-        if (my_rank % 2 == 1)
-        {
-            // ricevo da my_rank +1
-            // invio a my_rank -1
-            MPI_Recv(
-                &my_next[sendcnts[my_rank] * 2 * N], // buf
-                N,                                   // count
-                MPI_UNSIGNED_CHAR,                   // data type
-                my_rank + 1,                         // source
-                MPI_ANY_TAG,                         // tag
-                MPI_COMM_WORLD,
-                MPI_STATUS_IGNORE // status
-            );
-
-            MPI_Send(
-                my_next,           // buf
-                N,                 // count
-                MPI_UNSIGNED_CHAR, // data type
-                my_rank - 1,       // dest
-                0,                 // tag
-                MPI_COMM_WORLD);
-        }
-    }
-}
-
-void reconstruct_domain(cell_t *cur, cell_t *my_dom, int *sendcnts, int *displs, int N, int comm_sz, int my_rank, MPI_Datatype *two_row)
-{
-    // l'ultima riga di ogni dominio non è da considerare
-    // l'ultima riga valida dell'ultimo processo è la prima riga del dominio complessivo
-
-    /**
-     * l'ultimo processo manda al processo 0 la sua penultima riga (la prima del dom complessivo)
-     * ogni processo effettua una gatherv e invia i propi valori
-     */
-    if (my_rank == 0)
+/* Opzioni facoltative della riga di comando */
+typedef struct
+{
+    int halo;   /* profondita' dell'halo: passi eseguiti tra due scambi (0 = non indicata) */
+    int use_shm; /* lettura diretta degli halo dai vicini sullo stesso nodo (-1 = non indicata) */
+    int autotune; /* prova le configurazioni prima della simulazione */
+    hpp_alloc_policy_t mem; /* pagine grandi e nodo NUMA dei domini */
+    const char *manifest; /* modalita' ensemble (NULL se non richiesta) */
+    const char *cache_dir; /* cache degli scenari (NULL se non richiesta) */
+    const char *stats_name; /* segmento di telemetria (NULL se non richiesto) */
+    int delta_keyint; /* intervallo dei keyframe del flusso di frame (0 = file PGM) */
+    int preview_side; /* lato della mipmap di anteprima (0 = nessuna) */
+    const char *roi;  /* "x,y,w,h" del ritaglio a piena risoluzione (NULL = nessuno) */
+} options_t;
+
+/* Estrae da argv le opzioni "--nome=valore" (ammesse in qualunque
+   posizione) lasciando solo gli argomenti posizionali [N|NxM [S]] input */
+void parse_options(int *argc, char *argv[], options_t *opt)
+{
+    int i, n = 1;
+
+    opt->halo = 0;
+    opt->use_shm = -1;
+    opt->autotune = 0;
+    hpp_alloc_default(&opt->mem);
+    opt->manifest = NULL;
+    opt->cache_dir = NULL;
+    opt->stats_name = NULL;
+    opt->delta_keyint = 0;
+    opt->preview_side = 0;
+    opt->roi = NULL;
+    for (i = 1; i < *argc; i++)
     {
-        // ricevo la prima riga dall'ultimo processo nella prima posizione di cur
-        MPI_Recv(
-            cur,               // buf
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            comm_sz - 1,       // source
-            MPI_ANY_TAG,       // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
-        // ricevo l'ultima riga dall'ultimo processo
-        MPI_Recv(
-            &cur[N * (N - 1)], // buf  ricevo nel ultima riga
-            N,                 // count
-            MPI_UNSIGNED_CHAR, // data type
-            comm_sz - 1,       // source
-            MPI_ANY_TAG,       // tag
-            MPI_COMM_WORLD,
-            MPI_STATUS_IGNORE // status
-        );
-        sendcnts[comm_sz - 1]--;
-    }
-    if (my_rank == comm_sz - 1)
-    {
-        // invio la penultima riga al processo 0 che la riceve come prima riga
-        MPI_Send(
-            &my_dom[((sendcnts[my_rank] * 2) - 1) * N], // buf
-            N,                                          // count
-            MPI_UNSIGNED_CHAR,                          // data type
-            0,                                          // dest
-            0,                                          // tag
-            MPI_COMM_WORLD);
-        // invio la terzultima riga al processo 0 che la riceve come ultima
-        MPI_Send(
-            &my_dom[((sendcnts[my_rank] * 2) - 2) * N], // buf terzultima riga
-            N,                                          // count
-            MPI_UNSIGNED_CHAR,                          // data type
-            0,                                          // dest
-            0,                                          // tag
-            MPI_COMM_WORLD);
-        // abbasso il sendcont di uno
-        sendcnts[my_rank]--;
-    }
-
-    // gather dei risultati verso il th 0
-
-    MPI_Gatherv(
-        my_dom,            // const void *sendbuf
-        sendcnts[my_rank], // int sendcount
-        *two_row,          // MPI_Datatype sendtype
-        &cur[N],           // void *recvbuf         -> la prima riga è già completa
-        sendcnts,          // const int recvcounts[]
-        displs,            // const int displs[]
-        *two_row,          // MPI_Datatype recvtype
-        0,                 // int root
-        MPI_COMM_WORLD     // MPI_Comm comm
-    );
-
-    // correggo il sendcont dell'ultimo processo per il prossimo ciclo
-    if (my_rank == comm_sz - 1)
-    {
-        sendcnts[my_rank]++;
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[n++] = argv[i];
+        }
+        else if (strncmp(argv[i], "--halo=", 7) == 0)
+        {
+            opt->halo = atoi(argv[i] + 7);
+        }
+        else if (strncmp(argv[i], "--cache=", 8) == 0)
+        {
+            opt->cache_dir = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--ensemble=", 11) == 0)
+        {
+            opt->manifest = argv[i] + 11;
+        }
+        else if (strncmp(argv[i], "--stats=", 8) == 0)
+        {
+            opt->stats_name = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--preview=", 10) == 0)
+        {
+            opt->preview_side = atoi(argv[i] + 10);
+        }
+        else if (strncmp(argv[i], "--roi=", 6) == 0)
+        {
+            opt->roi = argv[i] + 6;
+        }
+        else if (strncmp(argv[i], "--delta=", 8) == 0)
+        {
+            opt->delta_keyint = atoi(argv[i] + 8);
+        }
+        else if (strcmp(argv[i], "--no-shm") == 0)
+        {
+            opt->use_shm = 0;
+        }
+        else if (strcmp(argv[i], "--autotune") == 0)
+        {
+            opt->autotune = 1;
+        }
+        else if (strncmp(argv[i], "--hugepages=", 12) == 0)
+        {
+            if (hpp_alloc_parse_huge(&opt->mem, argv[i] + 12) != 0)
+            {
+                fprintf(stderr, "FATAL: --hugepages must be off, thp or explicit\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strncmp(argv[i], "--numa=", 7) == 0)
+        {
+            if (hpp_alloc_parse_numa(&opt->mem, argv[i] + 7) != 0)
+            {
+                fprintf(stderr, "FATAL: --numa must be first-touch, interleave, bind or bind:N\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "FATAL: Unrecognized option `%s`\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
     }
+    argv[n] = NULL;
+    *argc = n;
 }
 
-int main(int argc, char *argv[])
+/* Segnala (una volta sola, dal processo 0) le parti di --hugepages e
+   --numa che il sistema non consente */
+void alloc_warn(const hpp_alloc_status_t *st, int my_rank)
 {
-    int t, N, nsteps;
-    FILE *filein;
-    int my_rank, comm_sz;
+    static int warned = 0;
 
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    if (my_rank == 0 && (st->missing & HPP_ALLOC_NO_HUGETLB) && !(warned & HPP_ALLOC_NO_HUGETLB))
+    {
+        fprintf(stderr, "WARNING: no explicit huge pages available (%s, see "
+                        "/proc/sys/vm/nr_hugepages), using transparent ones\n",
+                strerror(st->hugetlb_errno));
+    }
+    if (my_rank == 0 && (st->missing & HPP_ALLOC_NO_MBIND) && !(warned & HPP_ALLOC_NO_MBIND))
+    {
+        fprintf(stderr, "WARNING: can not set the NUMA policy of the domains: %s\n",
+                strerror(st->mbind_errno));
+    }
+    warned |= st->missing;
+}
 
-    //variabili per il calcolo del tempo di esecuzione
-    double begin = 0;
-    double end;
+/* Alloca (sul processo 0) una griglia completa con la politica di --hugepages e --numa */
+cell_t *grid_alloc(size_t size, const hpp_alloc_policy_t *mem, int my_rank)
+{
+    hpp_alloc_status_t st;
+    cell_t *grid = (cell_t *)hpp_grid_alloc(size, mem, &st);
 
-    if(my_rank == 0){
-        begin = MPI_Wtime();
+    if (grid == NULL)
+    {
+        fprintf(stderr, "FATAL: can not allocate the domain\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
-    srand(1234); /* Initialize PRNG deterministically */
+    alloc_warn(&st, my_rank);
+    return grid;
+}
 
-    if ((argc < 2) || (argc > 4))
+/**
+ * Vicini di un processo nel dominio toroidale (rank in comm). I domini locali sono
+ * allocati in una finestra MPI condivisa tra i processi dello stesso nodo:
+ * se un vicino risiede sullo stesso nodo prev_dom/succ_dom puntano
+ * direttamente al suo dominio locale, altrimenti valgono NULL e lo scambio
+ * avviene con messaggi.
+ */
+typedef struct
+{
+    MPI_Comm comm;          /* processi che partecipano alla simulazione */
+    int prev, succ;         /* rank dei vicini in comm */
+    const cell_t *prev_dom; /* dominio locale del precedente (o NULL) */
+    const cell_t *succ_dom; /* dominio locale del successivo (o NULL) */
+    int prev_own_rows;      /* righe proprie del precedente */
+    int any_shared;         /* almeno un vicino sullo stesso nodo */
+    MPI_Comm node_comm;     /* processi dello stesso nodo */
+    MPI_Win win;            /* finestra che contiene dom e next */
+} halo_t;
+
+/**
+ * Alloca dom e next (local_rows righe ciascuno) nella finestra condivisa
+ * del nodo e ricava i puntatori ai domini dei vicini sullo stesso nodo.
+ * Con use_shm == 0 tutti i vicini sono trattati come remoti.
+ */
+void halo_init(halo_t *halo, MPI_Comm comm, cell_t **dom, cell_t **next, int local_rows,
+               const int *sendcnts, int Ncol, int comm_sz, int my_rank, int use_shm,
+               const hpp_alloc_policy_t *mem)
+{
+    MPI_Group world_group, node_group;
+    MPI_Info info;
+    hpp_alloc_status_t st;
+    int ranks[2], node_ranks[2];
+    const MPI_Aint local_size = (MPI_Aint)2 * local_rows * Ncol * sizeof(cell_t);
+    cell_t *base;
+
+    halo->comm = comm;
+    halo->prev = (my_rank + comm_sz - 1) % comm_sz;
+    halo->succ = (my_rank + 1) % comm_sz;
+    halo->prev_own_rows = sendcnts[halo->prev] * 2;
+    halo->prev_dom = NULL;
+    halo->succ_dom = NULL;
+
+    MPI_Comm_split_type(comm, use_shm ? MPI_COMM_TYPE_SHARED : MPI_UNDEFINED,
+                        my_rank, MPI_INFO_NULL, &halo->node_comm);
+    if (halo->node_comm == MPI_COMM_NULL)
     {
-        fprintf(stderr, "Usage: %s [N [S]] input\n", argv[0]);
-        return EXIT_FAILURE;
+        // senza memoria condivisa ogni processo fa da se'
+        MPI_Comm_dup(MPI_COMM_SELF, &halo->node_comm);
     }
 
-    if (argc > 2)
+    // segmenti separati per processo, cosi' ognuno puo' scegliere pagine
+    // e nodo NUMA dei propri prima di toccarli
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    MPI_Win_allocate_shared(local_size, sizeof(cell_t), info, halo->node_comm,
+                            &base, &halo->win);
+    MPI_Info_free(&info);
+    assert(base != NULL);
+    *dom = base;
+    *next = base + (size_t)local_rows * Ncol;
+    memset(&st, 0, sizeof(st));
+    hpp_grid_place(base, local_size, mem, &st);
+    alloc_warn(&st, my_rank);
+    // il primo accesso e' del processo che aggiorna il dominio
+    memset(base, EMPTY, local_size);
+
+    // quali vicini stanno sullo stesso nodo?
+    ranks[0] = halo->prev;
+    ranks[1] = halo->succ;
+    MPI_Comm_group(comm, &world_group);
+    MPI_Comm_group(halo->node_comm, &node_group);
+    MPI_Group_translate_ranks(world_group, 2, ranks, node_group, node_ranks);
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&node_group);
+
+    if (node_ranks[0] != MPI_UNDEFINED)
     {
-        N = atoi(argv[1]);
+        MPI_Aint size;
+        int disp_unit;
+        cell_t *ptr;
+        MPI_Win_shared_query(halo->win, node_ranks[0], &size, &disp_unit, &ptr);
+        halo->prev_dom = ptr;
     }
-    else
+    if (node_ranks[1] != MPI_UNDEFINED)
     {
-        N = 512;
+        MPI_Aint size;
+        int disp_unit;
+        cell_t *ptr;
+        MPI_Win_shared_query(halo->win, node_ranks[1], &size, &disp_unit, &ptr);
+        halo->succ_dom = ptr;
     }
+    // tutti i processi del nodo devono partecipare alle stesse barriere
+    int shared = (halo->prev_dom != NULL || halo->succ_dom != NULL);
+    MPI_Allreduce(&shared, &halo->any_shared, 1, MPI_INT, MPI_LOR, halo->node_comm);
 
-    if (argc > 3)
+    // epoca di accesso passiva per tutta la durata della simulazione
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, halo->win);
+}
+
+void halo_free(halo_t *halo)
+{
+    MPI_Win_unlock_all(halo->win);
+    MPI_Win_free(&halo->win);
+    MPI_Comm_free(&halo->node_comm);
+}
+
+/**
+ * Scambio dell'halo profondo tra processi vicini (dominio toroidale).
+ * Il buffer locale contiene halo_rows righe ghost, own_rows righe proprie
+ * e altre halo_rows righe ghost:
+ * - l'halo inferiore sono le prime halo_rows righe proprie del successivo;
+ * - l'halo superiore sono le ultime halo_rows righe proprie del precedente.
+ * I vicini sullo stesso nodo vengono letti direttamente dalla finestra
+ * condivisa dopo una barriera di nodo; con gli altri si usano messaggi
+ * (MPI_PROC_NULL esclude dallo scambio la direzione gia' servita in
+ * memoria condivisa). Con un solo processo il vicino e' se stesso e lo
+ * scambio realizza il wrap.
+ */
+void exchange_halo(cell_t *buf, int own_rows, int halo_rows, int Ncol, const halo_t *halo)
+{
+    const int count = halo_rows * Ncol;
+    const uint64_t t0 = hpp_stats_now();
+
+    hpp_stats_activity(stats, HPP_STATS_EXCHANGE);
+
+    if (halo->any_shared)
     {
-        nsteps = atoi(argv[2]);
+        // le righe proprie dei vicini sono complete e visibili
+        MPI_Win_sync(halo->win);
+        MPI_Barrier(halo->node_comm);
+        MPI_Win_sync(halo->win);
+        if (halo->succ_dom != NULL)
+        {
+            memcpy(&buf[(size_t)(halo_rows + own_rows) * Ncol], &halo->succ_dom[(size_t)halo_rows * Ncol], count);
+        }
+        if (halo->prev_dom != NULL)
+        {
+            memcpy(buf, &halo->prev_dom[(size_t)halo->prev_own_rows * Ncol], count);
+        }
+    }
+
+    MPI_Sendrecv(
+        &buf[(size_t)halo_rows * Ncol],              // sendbuf: prime righe proprie
+        count, MPI_UNSIGNED_CHAR, halo->prev_dom != NULL ? MPI_PROC_NULL : halo->prev, 0,
+        &buf[(size_t)(halo_rows + own_rows) * Ncol], // recvbuf: halo inferiore
+        count, MPI_UNSIGNED_CHAR, halo->succ_dom != NULL ? MPI_PROC_NULL : halo->succ, 0,
+        halo->comm, MPI_STATUS_IGNORE);
+
+    MPI_Sendrecv(
+        &buf[(size_t)own_rows * Ncol],               // sendbuf: ultime righe proprie
+        count, MPI_UNSIGNED_CHAR, halo->succ_dom != NULL ? MPI_PROC_NULL : halo->succ, 1,
+        buf,                              // recvbuf: halo superiore
+        count, MPI_UNSIGNED_CHAR, halo->prev_dom != NULL ? MPI_PROC_NULL : halo->prev, 1,
+        halo->comm, MPI_STATUS_IGNORE);
+
+    if (halo->any_shared)
+    {
+        // nessuno sovrascrive il proprio dominio prima che i vicini lo abbiano letto
+        MPI_Barrier(halo->node_comm);
+    }
+    if (stats != NULL)
+    {
+        hpp_stats_add(&stats->exchange_ns, hpp_stats_now() - t0);
+        hpp_stats_add(&stats->bytes_exchanged, 2 * (uint64_t)count);
+    }
+    hpp_stats_activity(stats, HPP_STATS_STEP);
+}
+
+/**
+ * Esegue un passo completo sul buffer locale di nrows righe (nrows pari,
+ * la prima riga del buffer ha indice globale pari), lasciando il risultato
+ * in dom. La fase dispari non puo' aggiornare la prima e l'ultima riga,
+ * per cui ad ogni passo la zona valida si restringe di (al piu') due righe
+ * per lato: con un halo di 2h righe si possono fare h passi tra due scambi.
+ * Se reverse != 0 le fasi sono eseguite in ordine inverso (dispari, pari),
+ * riportando le particelle allo stato precedente.
+ */
+void local_step(cell_t *dom, cell_t *next, int nrows, int Ncol, int transposed, int reverse)
+{
+    const uint64_t t0 = hpp_stats_now();
+    uint64_t t1;
+
+    if (!reverse)
+    {
+        step(dom, next, nrows, Ncol, EVEN_PHASE, transposed);
+        t1 = hpp_stats_now();
+        step(&next[Ncol], &dom[Ncol], nrows - 2, Ncol, ODD_PHASE, transposed);
+        hpp_stats_phase(stats, 0, t1 - t0);
+        hpp_stats_phase(stats, 1, hpp_stats_now() - t1);
     }
     else
     {
-        nsteps = 32;
+        step(&dom[Ncol], &next[Ncol], nrows - 2, Ncol, ODD_PHASE, transposed);
+        t1 = hpp_stats_now();
+        step(next, dom, nrows, Ncol, EVEN_PHASE, transposed);
+        hpp_stats_phase(stats, 1, t1 - t0);
+        hpp_stats_phase(stats, 0, hpp_stats_now() - t1);
     }
+}
 
-    if (N % 2 != 0)
+/* Scrive il frame raccolto in cur, riportandolo prima (in frame)
+   all'orientamento del dominio se e' memorizzato trasposto */
+void write_frame(const cell_t *cur, cell_t *frame, int Nx, int Ny, int transposed,
+                 const char *prefix, int frameno)
+{
+    if (transposed)
     {
-        fprintf(stderr, "FATAL: the domain size N must be even\n");
-        return EXIT_FAILURE;
+        transpose(cur, frame, Nx, Ny);
+        cur = frame;
     }
+    write_image_named(cur, Nx, Ny, prefix, frameno);
+}
 
-    if (comm_sz > N / 2)
+/**
+ * Autotuning (--autotune): prima della simulazione vengono provate per
+ * qualche passo le profondita' dell'halo (potenze di 2 fino al massimo
+ * ammesso) con e senza lettura diretta degli halo in memoria condivisa,
+ * partendo dalle righe proprie del dominio reale. Il tempo di una prova
+ * e' il massimo tra i processi, per cui tutti scelgono la stessa
+ * configurazione; il processo 0 la salva nella cache di tuning
+ * dell'host (hpp-tune.h) sotto "mpi NxxNy P". Il numero di processi e'
+ * fissato da mpirun e non viene scelto.
+ */
+
+/**
+ * Completa la profondita' dell'halo e l'uso della memoria condivisa non
+ * indicati nelle opzioni (0 e -1) con la configurazione salvata nella
+ * cache di tuning per lo stesso dominio e numero di processi, letta dal
+ * processo 0; in sua assenza valgono halo 1 e memoria condivisa.
+ */
+void tune_load(int Nx, int Ny, int comm_sz, int my_rank, int max_halo, int *halo_depth,
+               int *use_shm)
+{
+    int tuned[2] = {0, -1};
+
+    if (my_rank == 0)
     {
-        fprintf(stderr, "FATAL: number of MPI-process %d must be <= of domain size/2 (%d) \n", comm_sz, N / 2);
-        return EXIT_FAILURE;
+        char key[64], value[HPP_TUNE_LINE];
+        snprintf(key, sizeof(key), "mpi %dx%d %d", Nx, Ny, comm_sz);
+        if (hpp_tune_lookup(key, value, sizeof(value)) != 0 ||
+            sscanf(value, "%d %d", &tuned[0], &tuned[1]) != 2)
+        {
+            tuned[0] = 0;
+            tuned[1] = -1;
+        }
+    }
+    MPI_Bcast(tuned, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if (*halo_depth == 0)
+    {
+        *halo_depth = (tuned[0] >= 1 && tuned[0] <= max_halo) ? tuned[0] : 1;
     }
+    if (*use_shm < 0)
+    {
+        *use_shm = (tuned[1] == 0 || tuned[1] == 1) ? tuned[1] : 1;
+    }
+}
 
-    if ((filein = fopen(argv[argc - 1], "r")) == NULL)
+/* durata indicativa di una prova, in secondi */
+#define TUNE_TRIAL_TIME 0.1
+/* profondita' massima provata: i passi di una prova ne sono un multiplo */
+#define TUNE_MAX_HALO 16
+
+/* Secondi per passo con halo di profondita' h, a partire dalle righe proprie own */
+double tune_trial(MPI_Comm comm, const cell_t *own, const int *sendcnts, int Ncol, int transposed,
+                  int h, int shm, const hpp_alloc_policy_t *mem, int nsteps)
+{
+    int my_rank, comm_sz, t;
+    int since_exchange = h;
+    cell_t *dom, *next;
+    halo_t halo;
+    double t0, elapsed;
+
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    const int own_rows = sendcnts[my_rank] * 2;
+    const int local_rows = own_rows + 4 * h;
+
+    halo_init(&halo, comm, &dom, &next, local_rows, sendcnts, Ncol, comm_sz, my_rank, shm, mem);
+    memcpy(&dom[(size_t)2 * h * Ncol], own, (size_t)own_rows * Ncol);
+    MPI_Barrier(comm);
+    t0 = MPI_Wtime();
+    for (t = 0; t < nsteps; t++)
     {
-        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", argv[argc - 1]);
-        return EXIT_FAILURE;
+        if (since_exchange == h)
+        {
+            exchange_halo(dom, own_rows, 2 * h, Ncol, &halo);
+            since_exchange = 0;
+        }
+        local_step(dom, next, local_rows, Ncol, transposed, 0);
+        since_exchange++;
+    }
+    elapsed = MPI_Wtime() - t0;
+    halo_free(&halo);
+    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return elapsed / nsteps;
+}
+
+/**
+ * Sceglie *halo_depth e *use_shm tra le configurazioni ammesse (quelle
+ * indicate esplicitamente nelle opzioni restano fisse) e le salva nella
+ * cache di tuning.
+ */
+void autotune(MPI_Comm comm, const cell_t *own, const int *sendcnts, int Nrow, int Ncol,
+              int transposed, int Nx, int Ny, const options_t *opt, int *halo_depth, int *use_shm)
+{
+    int my_rank, comm_sz, h, shm, nsteps, k;
+    int depths[8], ndepths = 0;
+    double t, tbest = HUGE_VAL;
+    // le prove non compaiono nella telemetria
+    hpp_stats_slot_t *saved_stats = stats;
+
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+    const int max_halo = (Nrow / 2) / comm_sz;
+    const double cells = (double)Nx * Ny;
+
+    stats = NULL;
+    // passi per prova: circa TUNE_TRIAL_TIME con la configurazione di partenza
+    t = tune_trial(comm, own, sendcnts, Ncol, transposed, *halo_depth, *use_shm, &opt->mem,
+                   TUNE_MAX_HALO);
+    nsteps = TUNE_MAX_HALO * (int)ceil(TUNE_TRIAL_TIME / (TUNE_MAX_HALO * (t > 1e-9 ? t : 1e-9)));
+    nsteps = nsteps > 64 * TUNE_MAX_HALO ? 64 * TUNE_MAX_HALO : nsteps;
+
+    if (opt->halo != 0)
+    {
+        depths[ndepths++] = opt->halo;
     }
-    
+    for (h = 1; opt->halo == 0 && h <= max_halo && h <= TUNE_MAX_HALO; h *= 2)
+    {
+        depths[ndepths++] = h;
+    }
+    for (k = 0; k < ndepths; k++)
+    {
+        h = depths[k];
+        for (shm = 1; shm >= 0; shm--)
+        {
+            if (opt->use_shm >= 0 && shm != opt->use_shm)
+            {
+                continue;
+            }
+            t = tune_trial(comm, own, sendcnts, Ncol, transposed, h, shm, &opt->mem, nsteps);
+            if (my_rank == 0)
+            {
+                printf("autotune: halo=%d shm=%d: %.3f ns per cell\n", h, shm, t * 1e9 / cells);
+            }
+            if (t < tbest)
+            {
+                tbest = t;
+                *halo_depth = h;
+                *use_shm = shm;
+            }
+        }
+    }
+    stats = saved_stats;
+
+    if (my_rank == 0)
+    {
+        char key[64], value[HPP_TUNE_LINE];
+
+        printf("autotune: best halo=%d shm=%d (%.3f ns per cell)\n", *halo_depth, *use_shm,
+               tbest * 1e9 / cells);
+        snprintf(key, sizeof(key), "mpi %dx%d %d", Nx, Ny, comm_sz);
+        snprintf(value, sizeof(value), "%d %d %.3f", *halo_depth, *use_shm, tbest * 1e9 / cells);
+        if (hpp_tune_store(key, value) != 0)
+        {
+            fprintf(stderr, "WARNING: can not write the tuning cache: %s\n", strerror(errno));
+        }
+    }
+}
+
+/**
+ * Esegue nsteps passi sul dominio di Ny righe di Nx celle descritto da
+ * filein con i processi di comm. Solo il processo 0 di comm legge il file
+ * (dopo srand(seed), passando per la cache degli scenari se richiesta) e
+ * scrive le immagini, con nome "<prefix>NNNNN.pgm". Restituisce (sul
+ * processo 0 di comm) il tempo impiegato dai passi di simulazione.
+ * Il dominio e' diviso in fasce di righe lungo il lato piu' lungo: se
+ * Nx > Ny viene memorizzato trasposto (Nx righe di Ny celle), cosi' i
+ * processi possono essere fino a max(Nx, Ny)/2 e gli halo scambiati sono
+ * lunghi quanto il lato corto.
+ */
+double simulate(MPI_Comm comm, FILE *filein, unsigned seed, int Nx, int Ny, int nsteps,
+                int halo_depth, int use_shm, const options_t *opt, const char *prefix)
+{
+    int t, i;
+    int my_rank, comm_sz;
+    double begin = 0, end;
+    const int transposed = (Nx > Ny);
+    // righe e colonne del dominio come memorizzato
+    const int Nrow = transposed ? Nx : Ny;
+    const int Ncol = transposed ? Ny : Nx;
+
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &comm_sz);
+
     //datatype usato per semplificare lo scambio di dati
     MPI_Datatype two_row;
-    int two_row_dim = 2 * N;
+    int two_row_dim = 2 * Ncol;
     MPI_Type_contiguous(two_row_dim, MPI_UNSIGNED_CHAR, &two_row);
     MPI_Type_commit(&two_row);
 
     cell_t *cur = NULL;
-    const size_t GRID_SIZE = N * N * sizeof(cell_t);
+    // dominio nell'orientamento del file e delle immagini (cur se non trasposto)
+    cell_t *frame = NULL;
+    const size_t GRID_SIZE = (size_t)Nx * Ny * sizeof(cell_t);
     // array di offset (in row)
     int *displs = NULL;   
     // array contatore elementi da inviare (in two_row)
@@ -595,12 +962,11 @@ int main(int argc, char *argv[])
     displs = (int *)malloc(comm_sz * sizeof(int));
     sendcnts = (int *)malloc(comm_sz * sizeof(int)); 
 
-    int i;
     //calcolo array per l'invio di dati per scatterv e gatherv
     for (i = 0; i < comm_sz; i++)
     {
-        int start = ((N / 2) * i) / comm_sz;
-        int end = ((N / 2) * (i + 1)) / comm_sz;
+        int start = ((Nrow / 2) * i) / comm_sz;
+        int end = ((Nrow / 2) * (i + 1)) / comm_sz;
         sendcnts[i] = end - start;
         displs[i] = start;
     }
@@ -608,139 +974,603 @@ int main(int argc, char *argv[])
     //il processo 0 carica il dominio
     if (my_rank == 0)
     {
-        cur = (cell_t *)malloc(GRID_SIZE);
-        assert(cur != NULL);
-        read_problem(filein, cur, N);
+        cur = grid_alloc(GRID_SIZE, &opt->mem, my_rank);
+        frame = cur;
+        if (transposed)
+        {
+            frame = grid_alloc(GRID_SIZE, &opt->mem, my_rank);
+        }
+        load_problem(filein, frame, Nx, Ny, seed, opt->cache_dir);
+        if (transposed)
+        {
+            transpose(frame, cur, Ny, Nx);
+        }
+    }
+    if (preview != NULL)
+    {
+        preview->transposed = transposed;
+    }
+    if (opt->autotune)
+    {
+        // le prove partono dalle righe proprie del dominio reale
+        cell_t *own = (cell_t *)malloc((size_t)sendcnts[my_rank] * two_row_dim);
+        assert(own != NULL);
+        MPI_Scatterv(cur, sendcnts, displs, two_row, own, sendcnts[my_rank], two_row, 0, comm);
+        autotune(comm, own, sendcnts, Nrow, Ncol, transposed, Nx, Ny, opt, &halo_depth, &use_shm);
+        free(own);
+    }
+    // ogni processo crea il proprio dominio e next: righe proprie piu'
+    // halo_rows righe ghost sopra e sotto
+    const int own_rows = sendcnts[my_rank] * 2;
+    const int halo_rows = halo_depth * 2;
+    const int local_rows = own_rows + 2 * halo_rows;
+    cell_t *my_dom = NULL;
+    cell_t *my_next = NULL;
+    halo_t halo;
+    halo_init(&halo, comm, &my_dom, &my_next, local_rows, sendcnts, Ncol, comm_sz, my_rank, use_shm,
+              &opt->mem);
+
+    if (my_rank == 0)
+    {
+        begin = MPI_Wtime();
     }
-    // ogni processo crea il proprio dominio e next (compresa una riga aggiuntiva)
-    cell_t *my_dom = (cell_t *)malloc(N + (sendcnts[my_rank] * 2 * N) * sizeof(cell_t));
-    cell_t *my_next = (cell_t *)malloc(N + (sendcnts[my_rank] * 2 * N) * sizeof(cell_t));
-    assert(my_next != NULL);
+
+    // il dominio viene distribuito una sola volta: da qui in poi i
+    // processi comunicano solo per lo scambio degli halo
+    MPI_Scatterv(
+        cur,                  // senedbuf
+        sendcnts,             // sendcount
+        displs,               // offsets
+        two_row,              // datatype
+        &my_dom[(size_t)halo_rows * Ncol], // recvbuf
+        sendcnts[my_rank],    // recvcount
+        two_row,              // recv data type
+        0,                    // root
+        comm);
+
+    // passi eseguiti dall'ultimo scambio degli halo
+    int since_exchange = halo_depth;
 
     for (t = 0; t < nsteps; t++)
     {
-        // set di sendcnts e displs
-        for (i = 0; i < comm_sz; i++)
+#ifdef DUMP_ALL
+        if (preview != NULL)
         {
-            int start = ((N / 2) * i) / comm_sz;
-            int end = ((N / 2) * (i + 1)) / comm_sz;
-            sendcnts[i] = end - start;
-            displs[i] = start;
+            write_preview(&my_dom[(size_t)halo_rows * Ncol], 2 * displs[my_rank], own_rows, prefix, t, comm);
         }
-
-        // uso la scatterv per distribuire i dati
-        MPI_Scatterv(
-            cur,               // senedbuf
-            sendcnts,          // sendcount
-            displs,            // offsets
-            two_row,           // datatype
-            my_dom,            // recvbuf
-            sendcnts[my_rank], // recvcount
-            two_row,           // recv data type
-            0,                 // root
-            MPI_COMM_WORLD);
-
-#ifdef DUMP_ALL
-        if (my_rank == 0)
+        else
         {
-            write_image(cur, N, t);
+            MPI_Gatherv(&my_dom[(size_t)halo_rows * Ncol], sendcnts[my_rank], two_row,
+                        cur, sendcnts, displs, two_row, 0, comm);
+            if (my_rank == 0)
+            {
+                write_frame(cur, frame, Nx, Ny, transposed, prefix, t);
+            }
         }
 #endif
-        //esecuzione della fase pari (viene esclusa l'ultima riga)
-        step(my_dom, my_next, sendcnts[my_rank] * 2, N, EVEN_PHASE, my_rank);
-        //scambio di righe tra processi
-        invert_row_for_ODD(my_next, sendcnts, N, comm_sz, my_rank);
-        //esecuzione della fase dispari (viene esclusa la prima riga)
-        step(&my_next[N], my_dom, sendcnts[my_rank] * 2, N, ODD_PHASE, my_rank);
-        //viene ricostruito il dominio complessivo nel processo 0
-        reconstruct_domain(cur, my_dom, sendcnts, displs, N, comm_sz, my_rank, &two_row);
+        if (since_exchange == halo_depth)
+        {
+            exchange_halo(my_dom, own_rows, halo_rows, Ncol, &halo);
+            since_exchange = 0;
+        }
+        local_step(my_dom, my_next, local_rows, Ncol, transposed, 0);
+        since_exchange++;
+        hpp_stats_step(stats, t + 1);
     }
 #ifdef DUMP_ALL
     /* Reverse all particles and go back to the initial state */
     for (; t < 2 * nsteps; t++)
     {
-        if (my_rank == 0)
+        if (preview != NULL)
+        {
+            write_preview(&my_dom[(size_t)halo_rows * Ncol], 2 * displs[my_rank], own_rows, prefix, t, comm);
+        }
+        else
         {
-            printf("%d \n", t - nsteps);
-            write_image(cur, N, t);
-        }
-        // set di sendcnts e displs
-
-        for (i = 0; i < comm_sz; i++)
-        {
-            int start = ((N / 2) * i) / comm_sz;
-            int end = ((N / 2) * (i + 1)) / comm_sz;
-            sendcnts[i] = end - start;
-            displs[i] = start;
-        }
-
-        // uso la scatterv per distribuire i dati
-        MPI_Scatterv(
-            cur,               // senedbuf
-            sendcnts,          // sendcount
-            displs,            // offsets
-            two_row,           // datatype
-            my_dom,            // recvbuf
-            sendcnts[my_rank], // recvcount
-            two_row,           // recv data type
-            0,                 // root
-            MPI_COMM_WORLD);
-
-            //scambi di righe in preparazione alla fase dispari
-        invert_row_for_ODD(my_dom, sendcnts, N, comm_sz, my_rank);
-        step(&my_dom[N], my_next, sendcnts[my_rank] * 2, N, ODD_PHASE, my_rank);
-        //il dom viene ricostruito nel processo 0
-        reconstruct_domain(cur, my_next, sendcnts, displs, N, comm_sz, my_rank, &two_row);
-        
-        for (i = 0; i < comm_sz; i++)
-        {
-            int start = ((N / 2) * i) / comm_sz;
-            int end = ((N / 2) * (i + 1)) / comm_sz;
-            sendcnts[i] = end - start;
-            displs[i] = start;
-        }
-
-        //il dom viene diviso per l'esecuzione della fase pari
-        MPI_Scatterv(
-            cur,               // senedbuf
-            sendcnts,          // sendcount
-            displs,            // offsets
-            two_row,           // datatype
-            my_dom,            // recvbuf
-            sendcnts[my_rank], // recvcount
-            two_row,           // recv data type
-            0,                 // root
-            MPI_COMM_WORLD);
-
-            step(my_dom, my_next, sendcnts[my_rank] * 2, N, EVEN_PHASE, my_rank);
-
-            //il dom complessivo viene ricostruito nel processo 0
-            MPI_Gatherv(
-            my_next,            // const void *sendbuf
-            sendcnts[my_rank], // int sendcount
-            two_row,           // MPI_Datatype sendtype
-            cur,               // void *recvbuf        
-            sendcnts,          // const int recvcounts[]
-            displs,            // const int displs[]
-            two_row,           // MPI_Datatype recvtype
-            0,                 // int root
-            MPI_COMM_WORLD     // MPI_Comm comm
+            MPI_Gatherv(&my_dom[(size_t)halo_rows * Ncol], sendcnts[my_rank], two_row,
+                        cur, sendcnts, displs, two_row, 0, comm);
+            if (my_rank == 0)
+            {
+                printf("%d \n", t - nsteps);
+                write_frame(cur, frame, Nx, Ny, transposed, prefix, t);
+            }
+        }
+        if (since_exchange == halo_depth)
+        {
+            exchange_halo(my_dom, own_rows, halo_rows, Ncol, &halo);
+            since_exchange = 0;
+        }
+        local_step(my_dom, my_next, local_rows, Ncol, transposed, 1);
+        since_exchange++;
+        hpp_stats_step(stats, t + 1);
+    }
+#endif
+    if (preview != NULL)
+    {
+        // con le anteprime il dominio non viene raccolto
+        end = MPI_Wtime();
+        write_preview(&my_dom[(size_t)halo_rows * Ncol], 2 * displs[my_rank], own_rows, prefix, t, comm);
+    }
+    else
+    {
+        //il dominio complessivo viene ricostruito nel processo 0
+        MPI_Gatherv(
+            &my_dom[(size_t)halo_rows * Ncol], // const void *sendbuf  -> solo le righe proprie
+            sendcnts[my_rank],      // int sendcount
+            two_row,                // MPI_Datatype sendtype
+            cur,                    // void *recvbuf
+            sendcnts,               // const int recvcounts[]
+            displs,                 // const int displs[]
+            two_row,                // MPI_Datatype recvtype
+            0,                      // int root
+            comm                    // MPI_Comm comm
         );
 
+        end = MPI_Wtime();
+        if (my_rank == 0)
+        {
+            write_frame(cur, frame, Nx, Ny, transposed, prefix, t);
+        }
     }
-#endif
+    if (frame != cur)
+    {
+        hpp_grid_free(frame, GRID_SIZE);
+    }
+    hpp_grid_free(cur, GRID_SIZE);
+    halo_free(&halo);
+    free(displs);
+    free(sendcnts);
+    MPI_Type_free(&two_row);
+    return end - begin;
+}
+
+/**
+ * Modalita' ensemble: molte simulazioni indipendenti nella stessa
+ * esecuzione. Ogni riga del manifest descrive un job
+ *
+ *     input N S seed
+ *
+ * dove N e' la dimensione come sulla riga di comando, N oppure NxM (righe
+ * vuote o che iniziano con '#' sono ignorate). I file prodotti dal job k si
+ * chiamano "ensKKK-hppNNNNN.pgm".
+ */
+typedef struct
+{
+    char input[256];
+    int Nx, Ny, nsteps;
+    unsigned seed;
+    double cost; /* lavoro stimato: Nx*Ny*S aggiornamenti di cella */
+} job_t;
+
+/* Legge la dimensione del dominio, "N" per un quadrato N*N oppure "NxM"
+   per N colonne (Nx) e M righe (Ny); restituisce 0 se entrambi i lati
+   sono pari e positivi */
+int parse_size(const char *s, int *Nx, int *Ny)
+{
+    char *end;
+    long nx, ny;
+
+    nx = strtol(s, &end, 10);
+    ny = nx;
+    if (*end == 'x')
+    {
+        ny = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || nx < 2 || ny < 2 || nx % 2 != 0 || ny % 2 != 0 ||
+        nx > (1L << 30) || ny > (1L << 30))
+    {
+        return -1;
+    }
+    *Nx = (int)nx;
+    *Ny = (int)ny;
+    return 0;
+}
+
+/* Legge il manifest (ogni processo lo legge per conto suo); restituisce il
+   numero di job, memorizzati in *jobs */
+int read_manifest(const char *fname, job_t **jobs)
+{
+    FILE *f;
+    char line[512];
+    int njobs = 0, cap = 16;
+
+    if ((f = fopen(fname, "r")) == NULL)
+    {
+        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", fname);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    *jobs = (job_t *)malloc(cap * sizeof(job_t));
+    assert(*jobs != NULL);
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        job_t *job;
+        char first, size[32];
+
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+            continue;
+        if (njobs == cap)
+        {
+            cap *= 2;
+            *jobs = (job_t *)realloc(*jobs, cap * sizeof(job_t));
+            assert(*jobs != NULL);
+        }
+        job = &(*jobs)[njobs];
+        if (sscanf(line, "%255s %31s %d %u", job->input, size, &job->nsteps, &job->seed) != 4)
+        {
+            fprintf(stderr, "FATAL: malformed manifest line `%s`\n", line);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        if (parse_size(size, &job->Nx, &job->Ny) != 0)
+        {
+            fprintf(stderr, "FATAL: the sides of the domain must be even (job %d)\n", njobs);
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+        job->cost = (double)job->Nx * job->Ny * (job->nsteps > 0 ? job->nsteps : 1);
+        njobs++;
+    }
+    fclose(f);
+    return njobs;
+}
+
+/**
+ * Esegue i job del manifest. MPI_COMM_WORLD viene diviso (MPI_Comm_split)
+ * in min(njobs, comm_sz) gruppi di processi contigui; i job, dal piu'
+ * costoso, sono assegnati al gruppo meno carico (stessa assegnazione
+ * calcolata da tutti i processi). Ogni gruppo esegue i propri job uno
+ * dopo l'altro usando al piu' max(Nx, Ny)/2 dei suoi processi.
+ * Restituisce il numero di job falliti (sul processo 0).
+ */
+int run_ensemble(const char *manifest, const options_t *opt, int my_rank, int comm_sz)
+{
+    job_t *jobs;
+    int *group_of;
+    double *load;
+    int njobs, ngroups, color, k, g;
+    int nfailed = 0, total_failed = 0;
+    MPI_Comm group_comm;
+    int group_rank, group_sz;
+
+    njobs = read_manifest(manifest, &jobs);
+    if (njobs == 0)
+    {
+        free(jobs);
+        return 0;
+    }
+    ngroups = njobs < comm_sz ? njobs : comm_sz;
+    color = (my_rank * ngroups) / comm_sz;
+    MPI_Comm_split(MPI_COMM_WORLD, color, my_rank, &group_comm);
+    MPI_Comm_rank(group_comm, &group_rank);
+    MPI_Comm_size(group_comm, &group_sz);
+
+    // assegnazione LPT: i job dal piu' costoso al gruppo meno carico
+    group_of = (int *)malloc(njobs * sizeof(int));
+    load = (double *)calloc(ngroups, sizeof(double));
+    assert(group_of != NULL && load != NULL);
+    for (k = 0; k < njobs; k++)
+    {
+        group_of[k] = -1;
+    }
+    for (g = 0; g < njobs; g++)
+    {
+        int best = -1, best_g = 0;
+        for (k = 0; k < njobs; k++)
+        {
+            if (group_of[k] < 0 && (best < 0 || jobs[k].cost > jobs[best].cost))
+            {
+                best = k;
+            }
+        }
+        for (k = 1; k < ngroups; k++)
+        {
+            if (load[k] < load[best_g])
+            {
+                best_g = k;
+            }
+        }
+        group_of[best] = best_g;
+        load[best_g] += jobs[best].cost;
+    }
+
+    for (k = 0; k < njobs; k++)
+    {
+        const job_t *job = &jobs[k];
+        const int half = (job->Nx > job->Ny ? job->Nx : job->Ny) / 2;
+        MPI_Comm job_comm;
+        int job_sz, halo_depth, failed = 0;
+
+        if (group_of[k] != color)
+        {
+            continue;
+        }
+        // non piu' di una fascia di due righe per processo: gli altri restano in attesa
+        job_sz = group_sz < half ? group_sz : half;
+        MPI_Comm_split(group_comm, group_rank < job_sz ? 0 : MPI_UNDEFINED, group_rank, &job_comm);
+        if (job_comm == MPI_COMM_NULL)
+        {
+            continue;
+        }
+        halo_depth = opt->halo != 0 ? opt->halo : 1;
+        halo_depth = halo_depth < half / job_sz ? halo_depth : half / job_sz;
+
+        FILE *filein = NULL;
+        if (group_rank == 0 && (filein = fopen(job->input, "r")) == NULL)
+        {
+            fprintf(stderr, "job %d: can not open \"%s\" for reading\n", k, job->input);
+            failed = 1;
+        }
+        MPI_Bcast(&failed, 1, MPI_INT, 0, job_comm);
+        if (!failed)
+        {
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "ens%03d-hpp", k);
+            const double elapsed = simulate(job_comm, filein, job->seed, job->Nx, job->Ny,
+                                            job->nsteps, halo_depth, opt->use_shm != 0, opt,
+                                            prefix);
+            if (group_rank == 0)
+            {
+                printf("job %d (%s N=%dx%d S=%d seed=%u) on %d processes: elapsed time %lf\n",
+                       k, job->input, job->Nx, job->Ny, job->nsteps, job->seed, job_sz, elapsed);
+                fclose(filein);
+            }
+        }
+        else if (group_rank == 0)
+        {
+            //un job fallito conta una volta sola, non una per processo
+            nfailed++;
+        }
+        MPI_Comm_free(&job_comm);
+    }
+
+    MPI_Reduce(&nfailed, &total_failed, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
     if (my_rank == 0)
     {
-        write_image(cur, N, t);
+        printf("Ensemble: %d jobs on %d groups\n", njobs, ngroups);
+    }
+    MPI_Comm_free(&group_comm);
+    free(load);
+    free(group_of);
+    free(jobs);
+    return total_failed;
+}
+
+/**
+ * Crea il segmento di --stats con uno slot per processo, indicizzato dal
+ * rank in MPI_COMM_WORLD (su ogni nodo sono usati solo gli slot dei
+ * processi locali). Il primo processo di ogni nodo rimuove l'eventuale
+ * segmento rimasto da un'esecuzione precedente; se la creazione fallisce
+ * la simulazione prosegue senza telemetria.
+ */
+void stats_begin(hpp_stats_t *st, const char *name, int Nx, int Ny, int nsteps, int my_rank,
+                 int comm_sz)
+{
+    char shm_name[256];
+    MPI_Comm node_comm;
+    int node_rank;
+
+    hpp_stats_name(shm_name, sizeof(shm_name), name);
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    if (node_rank == 0)
+    {
+        shm_unlink(shm_name);
     }
-    if(cur != NULL){
-        free(cur);
+    MPI_Barrier(node_comm);
+    MPI_Comm_free(&node_comm);
+    if (hpp_stats_create(st, shm_name, comm_sz, Nx, Ny, nsteps) != 0)
+    {
+        fprintf(stderr, "WARNING: can not create the stats segment \"%s\": %s\n",
+                shm_name, strerror(errno));
+        return;
+    }
+    stats = &st->slots[my_rank];
+    hpp_stats_set(&stats->pid, (uint64_t)getpid());
+    hpp_stats_activity(stats, HPP_STATS_STEP);
+}
+
+/* Segna la fine dell'esecuzione e rimuove il segmento, dopo che tutti i
+   processi hanno terminato */
+void stats_end(hpp_stats_t *st, const char *name)
+{
+    char shm_name[256];
+
+    if (stats != NULL)
+    {
+        hpp_stats_activity(stats, HPP_STATS_DONE);
+        stats = NULL;
+        hpp_stats_close(st);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    hpp_stats_name(shm_name, sizeof(shm_name), name);
+    shm_unlink(shm_name);
+}
+
+/* I frame vanno nel flusso "<prefix>.hppd" invece che in file PGM (solo
+   il processo 0 scrive i frame) */
+void delta_begin(hpp_delta_writer_t *w, const char *prefix, int Nx, int Ny, int keyint)
+{
+    char fname[128];
+
+    snprintf(fname, sizeof(fname), "%s.hppd", prefix);
+    if (hpp_delta_open(w, fname, Nx, Ny, keyint) != 0)
+    {
+        fprintf(stderr, "FATAL: can not create the frame stream \"%s\"\n", fname);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    delta = w;
+}
+
+void delta_end(hpp_delta_writer_t *w)
+{
+    const double pgm_bytes = (double)w->frames * ((double)w->Nx * w->Ny + 32);
+
+    delta = NULL;
+    if (hpp_delta_close(w) != 0)
+    {
+        fprintf(stderr, "FATAL: error writing the frame stream\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    printf("Frame stream: %u frames, %.2f MiB (%.1fx smaller than PGM)\n", w->frames,
+           w->bytes_out / 1048576.0, pgm_bytes / w->bytes_out);
+}
+
+int main(int argc, char *argv[])
+{
+    int Nx, Ny, nsteps;
+    FILE *filein;
+    int my_rank, comm_sz;
+    options_t opt;
+    hpp_stats_t st;
+    hpp_delta_writer_t dw;
+    hpp_preview_t pv;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    //variabili per il calcolo del tempo di esecuzione
+    double begin = 0;
+    double end;
+
+    if(my_rank == 0){
+        begin = MPI_Wtime();
+    }
+
+    parse_options(&argc, argv, &opt);
+
+    if (opt.manifest != NULL)
+    {
+        if (opt.stats_name != NULL && my_rank == 0)
+        {
+            fprintf(stderr, "WARNING: --stats is ignored in ensemble mode\n");
+        }
+        if (opt.delta_keyint != 0 || opt.preview_side != 0 || opt.roi != NULL || opt.autotune)
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "FATAL: --delta, --preview, --roi and --autotune can not be used in "
+                                "ensemble mode\n");
+            }
+            MPI_Finalize();
+            return EXIT_FAILURE;
+        }
+        if (opt.halo < 0)
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "FATAL: halo depth %d must be positive\n", opt.halo);
+            }
+            MPI_Finalize();
+            return EXIT_FAILURE;
+        }
+        const int nfailed = run_ensemble(opt.manifest, &opt, my_rank, comm_sz);
+        if (my_rank == 0)
+        {
+            end = MPI_Wtime();
+            printf("Elapsed time: %lf \n", end - begin);
+        }
+        MPI_Finalize();
+        return nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if ((argc < 2) || (argc > 4))
+    {
+        fprintf(stderr, "Usage: %s [--halo=H] [--no-shm] [--autotune] [--cache=dir] [--stats=name]\n"
+                        "          [--hugepages=off|thp|explicit] [--numa=first-touch|interleave|bind[:N]]\n"
+                        "          [--delta=k | [--preview=S] [--roi=x,y,w,h]] [N|NxM [S]] input\n"
+                        "       %s [--halo=H] [--no-shm] [--cache=dir] --ensemble=manifest\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
     }
-    if(my_next != NULL){
-        free(my_next);
+
+    if (argc > 2)
+    {
+        if (parse_size(argv[1], &Nx, &Ny) != 0)
+        {
+            fprintf(stderr, "FATAL: the domain size must be N or NxM, with even sides\n");
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        Nx = Ny = 512;
+    }
+
+    if (argc > 3)
+    {
+        nsteps = atoi(argv[2]);
+    }
+    else
+    {
+        nsteps = 32;
+    }
+
+    // il dominio e' diviso lungo il lato piu' lungo
+    const int half = (Nx > Ny ? Nx : Ny) / 2;
+
+    if (comm_sz > half)
+    {
+        fprintf(stderr, "FATAL: number of MPI-process %d must be <= of domain size/2 (%d) \n", comm_sz, half);
+        return EXIT_FAILURE;
+    }
+
+    // ogni processo deve possedere almeno le 2h righe che invia come halo
+    if (opt.halo < 0 || opt.halo > half / comm_sz)
+    {
+        fprintf(stderr, "FATAL: halo depth %d must be in [1, %d]\n", opt.halo, half / comm_sz);
+        return EXIT_FAILURE;
     }
-    if(my_dom != NULL){
-        free(my_dom);
+    int halo_depth = opt.halo, use_shm = opt.use_shm;
+    tune_load(Nx, Ny, comm_sz, my_rank, half / comm_sz, &halo_depth, &use_shm);
+
+    if ((filein = fopen(argv[argc - 1], "r")) == NULL)
+    {
+        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", argv[argc - 1]);
+        return EXIT_FAILURE;
+    }
+
+    if (opt.delta_keyint < 0)
+    {
+        fprintf(stderr, "FATAL: the keyframe interval of --delta must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opt.preview_side != 0 || opt.roi != NULL)
+    {
+        hpp_preview_init(&pv, Nx, Ny, opt.preview_side);
+        if (opt.preview_side < 0 || (opt.preview_side == 0 && opt.roi == NULL) ||
+            (opt.roi != NULL && hpp_preview_parse_roi(&pv, opt.roi) != 0) ||
+            opt.delta_keyint != 0)
+        {
+            fprintf(stderr, "FATAL: --preview needs a positive side, --roi a crop inside the "
+                            "grid, and they exclude --delta\n");
+            return EXIT_FAILURE;
+        }
+        preview = &pv;
+    }
+
+    if (opt.delta_keyint > 0 && my_rank == 0)
+    {
+        delta_begin(&dw, "hpp", Nx, Ny, opt.delta_keyint);
+    }
+
+    if (opt.stats_name != NULL)
+    {
+#ifdef DUMP_ALL
+        stats_begin(&st, opt.stats_name, Nx, Ny, 2 * nsteps, my_rank, comm_sz);
+#else
+        stats_begin(&st, opt.stats_name, Nx, Ny, nsteps, my_rank, comm_sz);
+#endif
+    }
+
+    /* Initialize PRNG deterministically */
+    simulate(MPI_COMM_WORLD, filein, 1234, Nx, Ny, nsteps, halo_depth, use_shm, &opt, "hpp");
+
+    if (opt.stats_name != NULL)
+    {
+        stats_end(&st, opt.stats_name);
+    }
+    if (opt.delta_keyint > 0 && my_rank == 0)
+    {
+        delta_end(&dw);
     }
 
     if(my_rank == 0){
@@ -2,11 +2,31 @@
 * Author: Guariglia Daniel 0000916433
 * 
 */
+#define _POSIX_C_SOURCE 200809L /* mmap(), mkstemp(), posix_madvise() */
+#define _DEFAULT_SOURCE         /* syscall() */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <math.h> 
 #include <assert.h>
+#include <errno.h>
 #include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hpp-stats.h"
+#include "hpp-delta.h"
+#include "hpp-preview.h"
+#include "hpp-tune.h"
+#include "hpp-alloc.h"
+#include "hpp-cache.h"
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 typedef enum {
     WALL,
@@ -22,13 +42,23 @@ typedef enum {
 /* type of a cell of the domain */
 typedef unsigned char cell_t;
 
-/* Simplifies indexing on a N*N grid */
-int IDX(int i, int j, int N)
+/* telemetry slot of this process (NULL without --stats) */
+static hpp_stats_slot_t *stats = NULL;
+
+/* frame stream of --delta (NULL if the frames are written as PGM) */
+static hpp_delta_writer_t *delta = NULL;
+
+/* previews written instead of the frames (NULL without --preview/--roi) */
+static hpp_preview_t *preview = NULL;
+
+/* Simplifies indexing on a grid of Ny rows of Nx cells; the linear
+   index is 64-bit since Nx*Ny overflows an int past 2^31 cells */
+size_t IDX(int i, int j, int Nx, int Ny)
 {
     /* wrap-around */
-    i = (i+N) % N;
-    j = (j+N) % N;
-    return i*N + j;
+    i = (i+Ny) % Ny;
+    j = (j+Nx) % Nx;
+    return (size_t)i*Nx + j;
 }
 
 /* Swap the content of cells a and b, provided that neither is a WALL;
@@ -42,24 +72,136 @@ void swap_cells(cell_t *a, cell_t *b)
     }
 }
 
-/* Compute the `next` grid given the `cur`-rent configuration. */
-void step( const cell_t *cur, cell_t *next, int N, phase_t phase )
+/* Variants of the kernel of the dense engine */
+typedef enum {
+    KERNEL_GENERIC,     /* wrap-around through IDX() on every cell */
+    KERNEL_ROWS         /* row pointers, wrap-around on the last block only */
+} kernel_t;
+
+/* Configuration of the dense engine, chosen by --autotune or loaded
+   from the tuning cache; the initial values are the untuned ones */
+typedef struct {
+    kernel_t kernel;
+    int nthreads;           /* 0 = OpenMP default */
+    omp_sched_t schedule;   /* schedule of the pairs of rows... */
+    int chunk;              /* ...and its chunk (0 = default) */
+} tuning_t;
+
+static tuning_t tuning = { KERNEL_GENERIC, 0, omp_sched_static, 0 };
+
+/* Kernel of step_team() that wraps around through IDX() on every cell */
+void step_team_generic( const cell_t *cur, cell_t *next, int Nx, int Ny, phase_t phase )
+{
+    int i, j;
+
+    //le coppie di righe sono divise tra i thread secondo lo schedule di tuning (vedi step())
+    //ogni thread chiama sempre 2 chiamate a swap_cells
+    #pragma omp for schedule(runtime) nowait
+    for (i=0; i<Ny; i+=2) {
+        for (j=0; j<Nx; j+=2) {
+            const size_t a = IDX(i      , j      , Nx, Ny);
+            const size_t b = IDX(i      , j+phase, Nx, Ny);
+            const size_t c = IDX(i+phase, j      , Nx, Ny);
+            const size_t d = IDX(i+phase, j+phase, Nx, Ny);
+
+            next[a] = cur[a];
+            next[b] = cur[b];
+            next[c] = cur[c];
+            next[d] = cur[d];
+            if ((((next[a] == EMPTY) != (next[b] == EMPTY)) &&
+                 ((next[c] == EMPTY) != (next[d] == EMPTY))) ||
+                (next[a] == WALL) || (next[b] == WALL) ||
+                (next[c] == WALL) || (next[d] == WALL)) {
+                swap_cells(&next[a], &next[b]);
+                swap_cells(&next[c], &next[d]);
+            } else {
+                swap_cells(&next[a], &next[d]);
+                swap_cells(&next[b], &next[c]);
+            }
+        }
+    }
+}
+
+/* Same result as step_team_generic(): the two rows of the blocks are
+   addressed through pointers and the cells are updated in registers,
+   so only the columns at the edges wrap around */
+void step_team_rows( const cell_t *cur, cell_t *next, int Nx, int Ny, phase_t phase )
+{
+    int i, j;
+
+    #pragma omp for schedule(runtime) nowait
+    for (i=0; i<Ny; i+=2) {
+        const size_t i1 = (size_t)((i+phase+Ny) % Ny) * Nx;
+        const cell_t *top = cur + (size_t)i*Nx, *bot = cur + i1;
+        cell_t *ntop = next + (size_t)i*Nx, *nbot = next + i1;
+
+        for (j=0; j<Nx; j+=2) {
+            const int jb = (j+phase < 0) ? Nx-1 : ((j+phase == Nx) ? 0 : j+phase);
+            cell_t a = top[j], b = top[jb], c = bot[j], d = bot[jb];
+
+            if ((((a == EMPTY) != (b == EMPTY)) && ((c == EMPTY) != (d == EMPTY))) ||
+                (a == WALL) || (b == WALL) || (c == WALL) || (d == WALL)) {
+                swap_cells(&a, &b);
+                swap_cells(&c, &d);
+            } else {
+                const cell_t ta = a, tb = b;
+                a = d; d = ta;
+                b = c; c = tb;
+            }
+            ntop[j] = a;
+            ntop[jb] = b;
+            nbot[j] = c;
+            nbot[jb] = d;
+        }
+    }
+}
+
+/* Compute the `next` grid given the `cur`-rent configuration; must be
+   called by all the threads of a parallel region, which share the
+   blocks according to the runtime schedule (see step()). The threads
+   do not wait for each other at the end: the caller needs a barrier
+   before using `next`. */
+void step_team( const cell_t *cur, cell_t *next, int Nx, int Ny, phase_t phase )
+{
+    assert(cur != NULL);
+    assert(next != NULL);
+
+    if (tuning.kernel == KERNEL_ROWS) {
+        step_team_rows(cur, next, Nx, Ny, phase);
+    } else {
+        step_team_generic(cur, next, Nx, Ny, phase);
+    }
+}
+
+/* Compute the `next` grid given the `cur`-rent configuration. The
+   schedule is a setting of the calling thread, which may be any
+   thread (libhpp, ensemble jobs), so it is set on every call. */
+void step( const cell_t *cur, cell_t *next, int Nx, int Ny, phase_t phase )
+{
+    omp_set_schedule(tuning.schedule, tuning.chunk);
+    #pragma omp parallel default(shared)
+    step_team(cur, next, Nx, Ny, phase);
+}
+
+/* Same as step(), but on a slab of `nrows` rows of Nx cells (`nrows`
+   even, first row with an even global index) that does not wrap around vertically:
+   only the columns are periodic. The odd phase cannot update the first
+   and the last row of the slab, whose content in `next` is left
+   untouched. */
+void step_slab( const cell_t *cur, cell_t *next, int nrows, int Nx, phase_t phase )
 {
     int i, j;
 
     assert(cur != NULL);
     assert(next != NULL);
-    
 
-    //ogni thread calcola una porzione uguale del totale, tutti i thread eseguono lo stesso numero di operazioni
-    //ogni thread chiama sempre 2 chiamate a swap_cells
-    #pragma omp parallel for default(shared) 
-    for (i=0; i<N; i+=2) {
-        for (j=0; j<N; j+=2) {
-            const int a = IDX(i      , j      , N);
-            const int b = IDX(i      , j+phase, N);
-            const int c = IDX(i+phase, j      , N);
-            const int d = IDX(i+phase, j+phase, N);
+    #pragma omp parallel for default(shared)
+    for (i=(phase == EVEN_PHASE ? 0 : 2); i<nrows; i+=2) {
+        for (j=0; j<Nx; j+=2) {
+            const size_t a = (size_t)i*Nx + j;
+            const size_t b = (size_t)i*Nx + (j+phase+Nx) % Nx;
+            const size_t c = (size_t)(i+phase)*Nx + j;
+            const size_t d = (size_t)(i+phase)*Nx + (j+phase+Nx) % Nx;
 
             next[a] = cur[a];
             next[b] = cur[b];
@@ -82,64 +224,68 @@ void step( const cell_t *cur, cell_t *next, int N, phase_t phase )
 /**
  ** The functions below are used to draw onto the grid; since they are
  ** called during initialization only, they do not need to be
- ** parallelized.
+ ** parallelized. Coordinates are fractions of the width (x) and of the
+ ** height (y) of the domain; the radius of a circle is a fraction of
+ ** the shorter side, so that circles stay round.
  **/
-void box( cell_t *grid, int N, float x1, float y1, float x2, float y2, cell_value_t t )
+void box( cell_t *grid, int Nx, int Ny, float x1, float y1, float x2, float y2, cell_value_t t )
 {
-    const int ix1 = ceil(fminf(x1, x2) * N);
-    const int ix2 = ceil(fmaxf(x1, x2) * N);
-    const int iy1 = ceil(fminf(y1, y1) * N);
-    const int iy2 = ceil(fmaxf(y1, y2) * N);
+    const int ix1 = ceil(fminf(x1, x2) * Nx);
+    const int ix2 = ceil(fmaxf(x1, x2) * Nx);
+    const int iy1 = ceil(fminf(y1, y1) * Ny);
+    const int iy2 = ceil(fmaxf(y1, y2) * Ny);
     int i, j;
     for (i = iy1; i <= iy2; i++) {
         for (j = ix1; j <= ix2; j++) {
-            const int ij = IDX(N-1-i, j, N);
+            const size_t ij = IDX(Ny-1-i, j, Nx, Ny);
             grid[ij] = t;
         }
     }
 }
 
-void circle( cell_t *grid, int N, float x, float y, float r, cell_value_t t )
+void circle( cell_t *grid, int Nx, int Ny, float x, float y, float r, cell_value_t t )
 {
-    const int ix = ceil(x * N);
-    const int iy = ceil(y * N);
-    const int ir = ceil(r * N);
+    const int ix = ceil(x * Nx);
+    const int iy = ceil(y * Ny);
+    const int ir = ceil(r * (Nx < Ny ? Nx : Ny));
     int dx, dy;
     for (dy = -ir; dy <= ir; dy++) {
         for (dx = -ir; dx <= ir; dx++) {
-            if (dx*dx + dy*dy <= ir*ir) {
-                const int ij = IDX(N-1-iy-dy, ix+dx, N);
+            if ((long long)dx*dx + (long long)dy*dy <= (long long)ir*ir) {
+                const size_t ij = IDX(Ny-1-iy-dy, ix+dx, Nx, Ny);
                 grid[ij] = t;
             }
         }
     }
 }
 
-void random_fill( cell_t *grid, int N, float x1, float y1, float x2, float y2, float p )
+void random_fill( cell_t *grid, int Nx, int Ny, float x1, float y1, float x2, float y2, float p )
 {
-    const int ix1 = ceil(fminf(x1, x2) * N);
-    const int ix2 = ceil(fmaxf(x1, x2) * N);
-    const int iy1 = ceil(fminf(y1, y1) * N);
-    const int iy2 = ceil(fmaxf(y1, y2) * N);
+    const int ix1 = ceil(fminf(x1, x2) * Nx);
+    const int ix2 = ceil(fmaxf(x1, x2) * Nx);
+    const int iy1 = ceil(fminf(y1, y1) * Ny);
+    const int iy2 = ceil(fmaxf(y1, y2) * Ny);
     int i, j;
     for (i = iy1; i <= iy2; i++) {
         for (j = ix1; j <= ix2; j++) {
-            const int ij = IDX(N-1-i, j, N);
+            const size_t ij = IDX(Ny-1-i, j, Nx, Ny);
             if (grid[ij] == EMPTY && ((float)rand())/RAND_MAX < p)
                 grid[ij] = GAS;
         }
     }
 }
 
-void read_problem( FILE *filein, cell_t *grid, int N )
+/* Draw the scenario described by `filein` onto `grid`; returns 0, or
+   the first command that is unknown or malformed */
+int read_problem( FILE *filein, cell_t *grid, int Nx, int Ny )
 {
     int i,j;
     int nread;
     char op;
 
-    for (i=0; i<N; i++) {
-        for (j=0; j<N; j++) {
-            const int ij = IDX(i,j,N);
+    for (i=0; i<Ny; i++) {
+        for (j=0; j<Nx; j++) {
+            const size_t ij = IDX(i,j,Nx,Ny);
             grid[ij] = EMPTY;
         }
     }
@@ -147,119 +293,1997 @@ void read_problem( FILE *filein, cell_t *grid, int N )
     while ((nread = fscanf(filein, " %c", &op)) == 1) {
         int t;
         float x1, y1, x2, y2, r, p;
-        int retval;
 
         switch (op) {
         case 'c' : /* circle */
-            retval = fscanf(filein, "%f %f %f %d", &x1, &y1, &r, &t);
-            assert(retval == 4);
-            circle(grid, N, x1, y1, r, t);
+            if (fscanf(filein, "%f %f %f %d", &x1, &y1, &r, &t) != 4)
+                return op;
+            circle(grid, Nx, Ny, x1, y1, r, t);
             break;
         case 'b': /* box */
-            retval = fscanf(filein, "%f %f %f %f %d", &x1, &y1, &x2, &y2, &t);
-            assert(retval == 5);
-            box(grid, N, x1, y1, x2, y2, t);
+            if (fscanf(filein, "%f %f %f %f %d", &x1, &y1, &x2, &y2, &t) != 5)
+                return op;
+            box(grid, Nx, Ny, x1, y1, x2, y2, t);
             break;
         case 'r': /* random_fill */
-            retval = fscanf(filein, "%f %f %f %f %f", &x1, &y1, &x2, &y2, &p);
-            assert(retval == 5);
-            random_fill(grid, N, x1, y1, x2, y2, p);
+            if (fscanf(filein, "%f %f %f %f %f", &x1, &y1, &x2, &y2, &p) != 5)
+                return op;
+            random_fill(grid, Nx, Ny, x1, y1, x2, y2, p);
             break;
         default:
-            fprintf(stderr, "FATAL: Unrecognized command `%c`\n", op);
-            exit(EXIT_FAILURE);
+            return op;
         }
     }
+    return 0;
 }
 
 
-/* Write an image of `grid` to a file in PGM (Portable Graymap)
-   format. `frameno` is the time step number, used for labeling the
-   output file. */
-void write_image( const cell_t *grid, int N, int frameno )
+/* Initialize `grid` from `filein` after seeding the PRNG with `seed`,
+   going through the scenario cache if `cache_dir` is not NULL */
+void load_problem( FILE *filein, cell_t *grid, int Nx, int Ny, unsigned seed, const char *cache_dir )
+{
+    hpp_cache_key_t key;
+    int op;
+
+    if (cache_dir != NULL) {
+        hpp_cache_key(&key, filein, Nx, Ny, seed);
+        if (hpp_cache_load(cache_dir, &key, grid) == 0)
+            return;
+    }
+    srand(seed);
+    if ((op = read_problem(filein, grid, Nx, Ny)) != 0) {
+        fprintf(stderr, "FATAL: Unrecognized or malformed command `%c`\n", op);
+        exit(EXIT_FAILURE);
+    }
+    if (cache_dir != NULL)
+        hpp_cache_store(cache_dir, &key, grid);
+}
+
+/* Write `grid` to the PGM file `fname`; returns 0 on success */
+int write_pgm( const cell_t *grid, int Nx, int Ny, const char *fname )
 {
     FILE *f;
-    char fname[128];
 
-    snprintf(fname, sizeof(fname), "hpp%05d.pgm", frameno);
     if ((f = fopen(fname, "w")) == NULL) {
-        printf("Cannot open \"%s\" for writing\n", fname);
-        abort();
+        return -1;
     }
     fprintf(f, "P5\n");
     fprintf(f, "# produced by hpp\n");
-    fprintf(f, "%d %d\n", N, N);
+    fprintf(f, "%d %d\n", Nx, Ny);
     fprintf(f, "%d\n", EMPTY); /* highest shade of grey (0=black) */
-    fwrite(grid, 1, N*N, f);
-    fclose(f);
+    fwrite(grid, 1, (size_t)Nx*Ny, f);
+    return fclose(f) == 0 ? 0 : -1;
 }
 
-int main( int argc, char* argv[] )
+/* Write the mipmap and the crop of --preview and --roi for a frame */
+void write_preview( const cell_t *grid, int Ny, const char *prefix, int frameno )
 {
-    int t, N, nsteps;
-    FILE *filein;
-
-    srand(1234); /* Initialize PRNG deterministically */
+    char fname[128];
 
-    if ( (argc < 2) || (argc > 4) ) {
-        fprintf(stderr, "Usage: %s [N [S]] input\n", argv[0]);
-        return EXIT_FAILURE;
+    if (preview->max_side > 0) {
+        const size_t npix = (size_t)preview->W * preview->H;
+        uint32_t *cnt = (uint32_t*)calloc(2*npix, sizeof(uint32_t)); /* gas, then walls */
+        assert(cnt != NULL);
+        hpp_preview_count(preview, grid, 0, Ny, cnt, cnt + npix);
+        snprintf(fname, sizeof(fname), "%s-preview%05d.pgm", prefix, frameno);
+        if (hpp_preview_write(preview, cnt, cnt + npix, fname) != 0) {
+            printf("Cannot open \"%s\" for writing\n", fname);
+            abort();
+        }
+        free(cnt);
     }
+    if (preview->roi[2] > 0) {
+        cell_t *crop = (cell_t*)malloc((size_t)preview->roi[2] * preview->roi[3]);
+        assert(crop != NULL);
+        hpp_preview_crop(preview, grid, 0, Ny, crop);
+        snprintf(fname, sizeof(fname), "%s-roi%05d.pgm", prefix, frameno);
+        if (hpp_preview_write_crop(preview, crop, EMPTY, fname) != 0) {
+            printf("Cannot open \"%s\" for writing\n", fname);
+            abort();
+        }
+        free(crop);
+    }
+}
 
-    if (argc > 2) {
-        N = atoi(argv[1]);
+/* Write an image of `grid` to a file in PGM (Portable Graymap)
+   format. `frameno` is the time step number, used for labeling the
+   output file, whose name is `prefix` followed by the frame number. */
+void write_image_named( const cell_t *grid, int Nx, int Ny, const char *prefix, int frameno )
+{
+    char fname[128];
+
+    hpp_stats_activity(stats, HPP_STATS_OUTPUT);
+    if (preview != NULL) {
+        write_preview(grid, Ny, prefix, frameno);
+    } else if (delta != NULL) {
+        hpp_delta_write(delta, grid);
     } else {
-        N = 512;
+        snprintf(fname, sizeof(fname), "%s%05d.pgm", prefix, frameno);
+        if (write_pgm(grid, Nx, Ny, fname) != 0) {
+            printf("Cannot open \"%s\" for writing\n", fname);
+            abort();
+        }
     }
+    if (stats != NULL) {
+        hpp_stats_add(&stats->frames_written, 1);
+    }
+    hpp_stats_activity(stats, HPP_STATS_STEP);
+}
 
-    if (argc > 3) {
-        nsteps = atoi(argv[2]);
+void write_image( const cell_t *grid, int Nx, int Ny, int frameno )
+{
+    write_image_named(grid, Nx, Ny, "hpp", frameno);
+}
+
+/* Advance `cur` by `nsteps` steps (using `next` as scratch space) and
+   write the final frame; with DUMP_ALL every frame is written and the
+   particles are then reversed back to the initial state. Returns the
+   elapsed time of the stepping loop. */
+double run_simulation( cell_t *cur, cell_t *next, int Nx, int Ny, int nsteps, const char *prefix )
+{
+    int t;
+    double tstart, tstop;
+
+    tstart = omp_get_wtime();
+
+    for (t=0; t<nsteps; t++) {
+#ifdef DUMP_ALL
+        write_image_named(cur, Nx, Ny, prefix, t);
+#endif
+        const uint64_t t0 = hpp_stats_now();
+        step(cur, next, Nx, Ny, EVEN_PHASE);
+        const uint64_t t1 = hpp_stats_now();
+        step(next, cur, Nx, Ny, ODD_PHASE);
+        hpp_stats_phase(stats, 0, t1 - t0);
+        hpp_stats_phase(stats, 1, hpp_stats_now() - t1);
+        hpp_stats_step(stats, t+1);
+    }
+#ifdef DUMP_ALL
+    /* Reverse all particles and go back to the initial state */
+    for (; t<2*nsteps; t++) {
+        write_image_named(cur, Nx, Ny, prefix, t);
+
+        const uint64_t t0 = hpp_stats_now();
+        step(cur, next, Nx, Ny, ODD_PHASE);   
+        const uint64_t t1 = hpp_stats_now();
+        step(next, cur, Nx, Ny, EVEN_PHASE);
+        hpp_stats_phase(stats, 1, t1 - t0);
+        hpp_stats_phase(stats, 0, hpp_stats_now() - t1);
+        hpp_stats_step(stats, t+1);
+    }
+#endif
+    tstop = omp_get_wtime();
+    write_image_named(cur, Nx, Ny, prefix, t);
+    return tstop - tstart;
+}
+
+/**
+ ** Hardware performance counters (--perf-counters): every thread opens
+ ** its own counters with perf_event_open(2) and reads them around its
+ ** share of each phase, so that the cost of step() is split per phase
+ ** and per thread. Counters that the kernel or the CPU do not provide
+ ** (e.g. inside most virtual machines) are reported as n/a and the
+ ** mode degrades to per-thread timing.
+ **/
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NEVENTS
+} perf_event_t;
+
+static const char *perf_event_name[PERF_NEVENTS] = {
+    "cycles", "instructions", "LLC-misses", "branch-misses"
+};
+
+/* Counters of one thread; index 0 of `value` and `time` is the even
+   phase, index 1 the odd one */
+typedef struct {
+    int fd[PERF_NEVENTS];                 /* -1 if not available */
+    double value[2][PERF_NEVENTS];
+    double time[2];                       /* seconds spent in the phase */
+} perf_thread_t;
+
+/* Open the counters of the calling thread; returns the errno of the
+   first counter that could not be opened, 0 if all of them are */
+int perf_open( perf_thread_t *pt )
+{
+    int k, err = 0;
+
+    memset(pt, 0, sizeof(*pt));
+    for (k=0; k<PERF_NEVENTS; k++) {
+        pt->fd[k] = -1;
+#ifdef __linux__
+        static const unsigned long long config[PERF_NEVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,   /* last level cache on most CPUs */
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[k];
+        attr.exclude_kernel = 1;  /* allowed with perf_event_paranoid <= 2 */
+        attr.exclude_hv = 1;
+        /* the counters may be multiplexed if there are not enough of them */
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pt->fd[k] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pt->fd[k] < 0 && err == 0) {
+            err = errno;
+        }
+#else
+        err = ENOSYS;
+#endif
+    }
+    return err;
+}
+
+/* Read the counters of the calling thread, scaled for multiplexing */
+void perf_read( const perf_thread_t *pt, double v[PERF_NEVENTS] )
+{
+    int k;
+
+    for (k=0; k<PERF_NEVENTS; k++) {
+        uint64_t buf[3]; /* value, time enabled, time running */
+        v[k] = 0.0;
+        if (pt->fd[k] >= 0 && read(pt->fd[k], buf, sizeof(buf)) == (ssize_t)sizeof(buf) &&
+            buf[2] > 0) {
+            v[k] = (double)buf[0] * ((double)buf[1] / buf[2]);
+        }
+    }
+}
+
+void perf_close( perf_thread_t *pt )
+{
+    int k;
+
+    for (k=0; k<PERF_NEVENTS; k++) {
+        if (pt->fd[k] >= 0) {
+            close(pt->fd[k]);
+        }
+    }
+}
+
+/* Best copy bandwidth (bytes read plus bytes written per second) of
+   all the threads over two buffers of `size` bytes, as the memory
+   roof of the summary */
+double perf_copy_bandwidth( size_t size )
+{
+    char *src = (char*)malloc(size), *dst = (char*)malloc(size);
+    double best = 0.0;
+    int r;
+
+    assert(src != NULL);
+    assert(dst != NULL);
+    #pragma omp parallel
+    {
+        const size_t nth = omp_get_num_threads(), me = omp_get_thread_num();
+        const size_t lo = size * me / nth, hi = size * (me+1) / nth;
+        /* first touch by the thread that copies the chunk */
+        memset(src + lo, 1, hi - lo);
+        memset(dst + lo, 0, hi - lo);
+    }
+    for (r=0; r<3; r++) {
+        const double tstart = omp_get_wtime();
+        #pragma omp parallel
+        {
+            const size_t nth = omp_get_num_threads(), me = omp_get_thread_num();
+            const size_t lo = size * me / nth, hi = size * (me+1) / nth;
+            memcpy(dst + lo, src + lo, hi - lo);
+        }
+        const double bw = 2.0 * size / (omp_get_wtime() - tstart);
+        best = (bw > best) ? bw : best;
+    }
+    free(src);
+    free(dst);
+    return best;
+}
+
+/* Print the counters per phase and per thread, then a roofline-style
+   summary of the whole run */
+void perf_report( const perf_thread_t *pt, int nthreads, int Nx, int Ny, int nsteps,
+                  double elapsed, int available[PERF_NEVENTS] )
+{
+    static const char *phase_name[2] = {"even", "odd"};
+    const double updates = 2.0 * Nx * Ny * nsteps; /* cells updated by the run */
+    double total[PERF_NEVENTS] = {0};
+    int p, t, k;
+
+    printf("Perf counters: %dx%d grid, %d steps, %d threads\n", Nx, Ny, nsteps, nthreads);
+    printf("%-5s %6s %10s", "phase", "thread", "time(s)");
+    for (k=0; k<PERF_NEVENTS; k++) {
+        printf(" %14s", perf_event_name[k]);
+    }
+    printf(" %6s\n", "IPC");
+    for (p=0; p<2; p++) {
+        double tmax = 0.0, tsum = 0.0, sum[PERF_NEVENTS] = {0};
+        for (t=0; t<=nthreads; t++) {
+            const double *v = (t < nthreads) ? pt[t].value[p] : sum;
+            const double time = (t < nthreads) ? pt[t].time[p] : tmax;
+            if (t < nthreads) {
+                printf("%-5s %6d %10.4f", phase_name[p], t, time);
+                tmax = (time > tmax) ? time : tmax;
+                tsum += time;
+                for (k=0; k<PERF_NEVENTS; k++) {
+                    sum[k] += v[k];
+                }
+            } else {
+                printf("%-5s %6s %10.4f", phase_name[p], "all", time);
+            }
+            for (k=0; k<PERF_NEVENTS; k++) {
+                if (available[k]) {
+                    printf(" %14.0f", v[k]);
+                } else {
+                    printf(" %14s", "n/a");
+                }
+            }
+            if (available[PERF_CYCLES] && available[PERF_INSTRUCTIONS] && v[PERF_CYCLES] > 0) {
+                printf(" %6.2f\n", v[PERF_INSTRUCTIONS] / v[PERF_CYCLES]);
+            } else {
+                printf(" %6s\n", "n/a");
+            }
+        }
+        printf("%-5s load imbalance (max/mean thread time): %.2f\n", phase_name[p],
+               tsum > 0 ? tmax * nthreads / tsum : 1.0);
+        for (k=0; k<PERF_NEVENTS; k++) {
+            total[k] += sum[k];
+        }
+    }
+
+    /* DRAM traffic is estimated from the line fills of the LLC misses
+       (write-backs are not counted), the same measure as the copy roof */
+    const double cache_line = 64.0;
+    const double gups = updates / elapsed * 1e-9;
+    const double peak = perf_copy_bandwidth((size_t)Nx*Ny < ((size_t)64 << 20) ?
+                                            ((size_t)64 << 20) : (size_t)Nx*Ny);
+    printf("Per cell-update:");
+    if (available[PERF_INSTRUCTIONS]) {
+        printf(" %.2f instructions,", total[PERF_INSTRUCTIONS] / updates);
+    }
+    if (available[PERF_CYCLES]) {
+        printf(" %.2f cycles,", total[PERF_CYCLES] / updates);
+    }
+    if (available[PERF_BRANCH_MISSES]) {
+        printf(" %.4f branch misses,", total[PERF_BRANCH_MISSES] / updates);
+    }
+    /* nominal traffic: every cell is read from cur and written to next */
+    if (available[PERF_LLC_MISSES]) {
+        printf(" %.2f bytes (2 nominal)\n", total[PERF_LLC_MISSES] * cache_line / updates);
     } else {
-        nsteps = 32;
+        printf(" 2 bytes nominal\n");
+    }
+    printf("Roofline: %.3f Gcell-updates/s, peak copy bandwidth %.2f GB/s\n", gups, peak * 1e-9);
+    if (!available[PERF_LLC_MISSES]) {
+        printf("Roofline: nominal traffic %.2f GB/s (%.0f%% of peak)\n",
+               2.0 * gups, 100.0 * 2.0 * gups * 1e9 / peak);
+        printf("Bound: unknown without LLC counters; ");
+        printf("%s\n", 2.0 * gups * 1e9 > 0.7 * peak ?
+               "the nominal traffic is close to the roof, likely memory-bound" :
+               "the nominal traffic is well below the roof, likely not memory-bound");
+        return;
+    }
+    const double bytes = total[PERF_LLC_MISSES] * cache_line;
+    const double bw = bytes / elapsed;
+    printf("Roofline: DRAM traffic %.2f GB/s (%.0f%% of peak), intensity %.3f cell-updates/byte\n",
+           bw * 1e-9, 100.0 * bw / peak, updates / bytes);
+    if (bw > 0.7 * peak) {
+        printf("Bound: memory bandwidth; reduce the bytes per cell-update "
+               "(temporal blocking, fused steps)\n");
+    } else if (available[PERF_BRANCH_MISSES] && total[PERF_BRANCH_MISSES] / updates > 0.02) {
+        printf("Bound: branch mispredictions in the block rule; try a branchless update\n");
+    } else {
+        printf("Bound: instruction throughput; reduce the instructions per cell-update "
+               "(IDX() modulo, vectorization)\n");
+    }
+}
+
+/* Same as run_simulation(), without DUMP_ALL, while collecting the
+   counters of every thread around its share of each phase */
+double run_simulation_perf( cell_t *cur, cell_t *next, int Nx, int Ny, int nsteps,
+                            const char *prefix )
+{
+    const int nthreads = omp_get_max_threads();
+    perf_thread_t *pt = (perf_thread_t*)malloc(nthreads * sizeof(*pt));
+    int available[PERF_NEVENTS];
+    int err = 0, t, k;
+    double tstart, tstop;
+
+    assert(pt != NULL);
+    omp_set_schedule(tuning.schedule, tuning.chunk);
+    tstart = omp_get_wtime();
+    #pragma omp parallel num_threads(nthreads) private(t, k)
+    {
+        const int me = omp_get_thread_num();
+        perf_thread_t *mine = &pt[me];
+        const int my_err = perf_open(mine);
+        double v0[PERF_NEVENTS], v1[PERF_NEVENTS];
+
+        if (my_err != 0) {
+            #pragma omp critical(perf_err)
+            err = my_err;
+        }
+        for (t=0; t<nsteps; t++) {
+            int p;
+            for (p=0; p<2; p++) {
+                const double t0 = omp_get_wtime();
+                perf_read(mine, v0);
+                if (p == 0) {
+                    step_team(cur, next, Nx, Ny, EVEN_PHASE);
+                } else {
+                    step_team(next, cur, Nx, Ny, ODD_PHASE);
+                }
+                /* read before the barrier, so that waiting is not counted */
+                perf_read(mine, v1);
+                mine->time[p] += omp_get_wtime() - t0;
+                for (k=0; k<PERF_NEVENTS; k++) {
+                    mine->value[p][k] += v1[k] - v0[k];
+                }
+                #pragma omp barrier
+            }
+        }
+        perf_close(mine);
     }
+    tstop = omp_get_wtime();
 
-    if (N % 2 != 0) {
-        fprintf(stderr, "FATAL: the domain size N must be even\n");
-        return EXIT_FAILURE;
+    for (k=0; k<PERF_NEVENTS; k++) {
+        int i;
+        available[k] = 1;
+        for (i=0; i<nthreads; i++) {
+            available[k] = available[k] && (pt[i].fd[k] >= 0);
+        }
+    }
+    if (err != 0) {
+        fprintf(stderr, "WARNING: some hardware counters are not available (%s); "
+                "check /proc/sys/kernel/perf_event_paranoid\n", strerror(err));
     }
+    perf_report(pt, nthreads, Nx, Ny, nsteps, tstop - tstart, available);
+    free(pt);
+    write_image_named(cur, Nx, Ny, prefix, nsteps);
+    return tstop - tstart;
+}
 
-    if ((filein = fopen(argv[argc-1], "r")) == NULL) {
-        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", argv[argc-1]);
-        return EXIT_FAILURE;
+/**
+ ** Out-of-core mode: the two grids live in memory-mapped temporary
+ ** files (removed at exit) and are processed one slab of rows at a
+ ** time. Each slab is copied into RAM together with 2T halo rows per
+ ** side and advanced by T steps at once, recomputing the shrinking
+ ** halo redundantly, so the grid is read and written once every T
+ ** steps instead of twice per step.
+ **/
+typedef struct {
+    const char *dir;    /* directory of the grid files */
+    int fuse;           /* steps fused in each pass over the grid (T) */
+    int slab_rows;      /* rows per slab (even); 0 = about 64 MiB */
+} ooc_options_t;
+
+/* Create an unlinked file of `size` bytes in `dir` and map it */
+cell_t *ooc_map( const char *dir, size_t size )
+{
+    char fname[4096];
+    int fd;
+    void *map;
+
+    snprintf(fname, sizeof(fname), "%s/hpp-grid-XXXXXX", dir);
+    if ((fd = mkstemp(fname)) < 0) {
+        fprintf(stderr, "FATAL: can not create \"%s\"\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    unlink(fname);
+    if (ftruncate(fd, (off_t)size) != 0) {
+        fprintf(stderr, "FATAL: can not extend \"%s\" to %zu bytes\n", fname, size);
+        exit(EXIT_FAILURE);
     }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "FATAL: can not map \"%s\"\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    return (cell_t*)map;
+}
 
-    const size_t GRID_SIZE = N*N*sizeof(cell_t);
-    cell_t *cur = (cell_t*)malloc(GRID_SIZE);
-    assert(cur != NULL);
-    cell_t *next = (cell_t*)malloc(GRID_SIZE);
-    assert(next != NULL);
+/* Hint the kernel to start reading rows [r0, r0+nrows) of `grid` */
+void ooc_prefetch( const cell_t *grid, int Nx, int Ny, int r0, int nrows )
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first, last;
+
+    if (r0 >= Ny)
+        return;
+    if (r0 + nrows > Ny)
+        nrows = Ny - r0;
+    first = ((size_t)r0*Nx) / page * page;
+    last = (size_t)(r0+nrows)*Nx;
+    posix_madvise((void*)(grid + first), last - first, POSIX_MADV_WILLNEED);
+}
+
+/* Start writing back rows [r0, r0+nrows) of `grid` */
+void ooc_writeback( cell_t *grid, int Nx, int r0, int nrows )
+{
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t first = ((size_t)r0*Nx) / page * page;
+
+    msync(grid + first, (size_t)(r0+nrows)*Nx - first, MS_ASYNC);
+}
+
+/* Advance `src` by `nsteps` steps (backwards if `reverse`) into `dst`,
+   one slab at a time. `buf` and `tmp` hold slab_rows + 4*nsteps rows. */
+void ooc_pass( const cell_t *src, cell_t *dst, int Nx, int Ny, int nsteps, int reverse,
+               int slab_rows, cell_t *buf, cell_t *tmp )
+{
+    const int halo_rows = 2*nsteps;
+    int r0, k, s;
+
+    for (r0=0; r0<Ny; r0+=slab_rows) {
+        const int own = (Ny - r0 < slab_rows ? Ny - r0 : slab_rows);
+        const int nrows = own + 2*halo_rows;
+
+        /* rows of the next slab not already read for this one */
+        ooc_prefetch(src, Nx, Ny, r0 + slab_rows + halo_rows, slab_rows);
+        for (k=0; k<nrows; k++)
+            memcpy(&buf[(size_t)k*Nx], &src[IDX(r0 - halo_rows + k, 0, Nx, Ny)], Nx);
+        for (s=0; s<nsteps; s++) {
+            if (!reverse) {
+                step_slab(buf, tmp, nrows, Nx, EVEN_PHASE);
+                step_slab(tmp, buf, nrows, Nx, ODD_PHASE);
+            } else {
+                step_slab(buf, tmp, nrows, Nx, ODD_PHASE);
+                step_slab(tmp, buf, nrows, Nx, EVEN_PHASE);
+            }
+        }
+        memcpy(&dst[(size_t)r0*Nx], &buf[(size_t)halo_rows*Nx], (size_t)own*Nx);
+        ooc_writeback(dst, Nx, r0, own);
+    }
+}
 
-    read_problem(filein, cur, N);
+/* Out-of-core counterpart of run_simulation() */
+double run_out_of_core( FILE *filein, unsigned seed, const char *cache_dir, int Nx, int Ny,
+                        int nsteps, const ooc_options_t *ooc )
+{
+    const size_t GRID_SIZE = (size_t)Nx*Ny*sizeof(cell_t);
+    int slab_rows = ooc->slab_rows;
+    int t, k;
     double tstart, tstop;
+    cell_t *cur, *next, *buf, *tmp, *swap;
+
+    if (slab_rows <= 0)
+        slab_rows = (int)((64u << 20) / (size_t)Nx) & ~1;
+    if (slab_rows < 2)
+        slab_rows = 2;
+    if (slab_rows > Ny)
+        slab_rows = Ny;
+
+    cur = ooc_map(ooc->dir, GRID_SIZE);
+    next = ooc_map(ooc->dir, GRID_SIZE);
+    buf = (cell_t*)malloc((size_t)(slab_rows + 4*ooc->fuse)*Nx);
+    assert(buf != NULL);
+    tmp = (cell_t*)malloc((size_t)(slab_rows + 4*ooc->fuse)*Nx);
+    assert(tmp != NULL);
+
+    load_problem(filein, cur, Nx, Ny, seed, cache_dir);
     tstart = omp_get_wtime();
 
-    for (t=0; t<nsteps; t++) {
+    for (t=0; t<nsteps; t+=k) {
+        k = (nsteps - t < ooc->fuse ? nsteps - t : ooc->fuse);
 #ifdef DUMP_ALL
-        write_image(cur, N, t);
+        write_image(cur, Nx, Ny, t);
+        k = 1;
 #endif
-        step(cur, next, N, EVEN_PHASE);
-        step(next, cur, N, ODD_PHASE);
-        
+        ooc_pass(cur, next, Nx, Ny, k, 0, slab_rows, buf, tmp);
+        swap = cur; cur = next; next = swap;
+        hpp_stats_step(stats, t+k);
     }
 #ifdef DUMP_ALL
     /* Reverse all particles and go back to the initial state */
     for (; t<2*nsteps; t++) {
-        write_image(cur, N, t);
-
-        step(cur, next, N, ODD_PHASE);   
-        step(next, cur, N, EVEN_PHASE);
+        write_image(cur, Nx, Ny, t);
+        ooc_pass(cur, next, Nx, Ny, 1, 1, slab_rows, buf, tmp);
+        swap = cur; cur = next; next = swap;
+        hpp_stats_step(stats, t+1);
     }
 #endif
     tstop = omp_get_wtime();
-    printf("Elapsed time: %f \n", tstop - tstart);
-    write_image(cur, N, t);
-    free(cur);
-    free(next);
-    fclose(filein);
-    return EXIT_SUCCESS;
+    write_image(cur, Nx, Ny, t);
+    free(buf);
+    free(tmp);
+    munmap(cur, GRID_SIZE);
+    munmap(next, GRID_SIZE);
+    return tstop - tstart;
+}
+
+/**
+ ** HashLife engine. The HPP rule is deterministic and local: after one
+ ** step (even + odd phase) a cell depends only on the cells at most two
+ ** positions away, so a square "macrocell" of side 2^k aligned on even
+ ** coordinates determines its central 2^(k-1) square after 2^(k-3)
+ ** steps. Macrocells are stored as hash-consed quadtrees (identical
+ ** sub-squares are the same node) and the results of advancing a node
+ ** by 2^j steps are memoized (in the node itself for the largest jump,
+ ** in a separate cache for the shorter ones), so the repeated structure
+ ** of wall-heavy scenes is computed only once and S can be jumped in
+ ** O(log S) levels of recursion. The torus of side N=2^m is advanced by embedding it in
+ ** a 2N macrocell made of four copies of the grid rolled by N/2, whose
+ ** center is the grid itself.
+ **
+ ** The node store is bounded: when it exceeds `max_nodes` between two
+ ** jumps the grid is flattened, every node and memo entry is dropped
+ ** and the quadtree is rebuilt. The cache of the shorter jumps is
+ ** direct-mapped, a colliding entry evicts the previous one.
+ **/
+#define HL_NIL 0xffffffffu
+
+typedef struct {
+    uint32_t child[4];  /* nw, ne, sw, se; unused at level 0 */
+    uint32_t next;      /* next node in the same hash bucket */
+    uint32_t level;     /* the node is a square of side 2^level */
+    uint32_t result;    /* centre after 2^(level-3) steps, or HL_NIL */
+} hl_node_t;
+
+typedef struct {
+    uint32_t node;      /* HL_NIL if the entry is empty */
+    uint32_t j;         /* `result` is `node` advanced by 2^j steps */
+    uint32_t result;
+} hl_memo_t;
+
+typedef struct {
+    hl_node_t *nodes;   /* nodes 0..2 are the cells WALL, GAS, EMPTY */
+    uint32_t nnodes, capacity, max_nodes;
+    uint32_t *bucket;
+    uint32_t nbuckets;
+    hl_memo_t *memo;
+    uint32_t nmemo;
+    unsigned long long hits, misses, evictions, flushed_nodes;
+    int flushes;
+} hashlife_t;
+
+typedef struct {
+    uint32_t max_nodes; /* soft bound of the node store */
+    uint32_t memo_size; /* entries of the memo cache (power of two) */
+} hashlife_options_t;
+
+uint32_t hl_hash( uint32_t a, uint32_t b, uint32_t c, uint32_t d )
+{
+    uint64_t h = a;
+    h = h * 0x9E3779B97F4A7C15ULL + b;
+    h = h * 0x9E3779B97F4A7C15ULL + c;
+    h = h * 0x9E3779B97F4A7C15ULL + d;
+    return (uint32_t)(h ^ (h >> 32));
 }
+
+/* Drop every node but the three cells, and every memo entry */
+void hl_reset( hashlife_t *hl )
+{
+    uint32_t i;
+
+    hl->flushed_nodes += (hl->nnodes > 3 ? hl->nnodes - 3 : 0);
+    for (i=0; i<3; i++) {
+        hl->nodes[i].level = 0;
+        hl->nodes[i].next = HL_NIL;
+        hl->nodes[i].result = HL_NIL;
+    }
+    hl->nnodes = 3;
+    for (i=0; i<hl->nbuckets; i++)
+        hl->bucket[i] = HL_NIL;
+    for (i=0; i<hl->nmemo; i++)
+        hl->memo[i].node = HL_NIL;
+}
+
+void hl_init( hashlife_t *hl, const hashlife_options_t *opt )
+{
+    memset(hl, 0, sizeof(*hl));
+    hl->max_nodes = opt->max_nodes;
+    hl->capacity = 1024;
+    hl->nodes = (hl_node_t*)malloc(hl->capacity * sizeof(hl_node_t));
+    assert(hl->nodes != NULL);
+    for (hl->nbuckets = 1024; hl->nbuckets < opt->max_nodes; hl->nbuckets *= 2)
+        ;
+    hl->bucket = (uint32_t*)malloc(hl->nbuckets * sizeof(uint32_t));
+    assert(hl->bucket != NULL);
+    hl->nmemo = opt->memo_size;
+    hl->memo = (hl_memo_t*)malloc(hl->nmemo * sizeof(hl_memo_t));
+    assert(hl->memo != NULL);
+    hl_reset(hl);
+    hl->flushed_nodes = 0;
+}
+
+void hl_free( hashlife_t *hl )
+{
+    free(hl->nodes);
+    free(hl->bucket);
+    free(hl->memo);
+}
+
+/* The canonical node with the given four quadrants */
+uint32_t hl_join( hashlife_t *hl, uint32_t nw, uint32_t ne, uint32_t sw, uint32_t se )
+{
+    const uint32_t h = hl_hash(nw, ne, sw, se) & (hl->nbuckets - 1);
+    uint32_t n;
+    hl_node_t *node;
+
+    for (n = hl->bucket[h]; n != HL_NIL; n = hl->nodes[n].next) {
+        const uint32_t *c = hl->nodes[n].child;
+        if (c[0] == nw && c[1] == ne && c[2] == sw && c[3] == se)
+            return n;
+    }
+    if (hl->nnodes == hl->capacity) {
+        /* the bound is enforced between jumps, here the store can grow */
+        assert(hl->capacity < HL_NIL / 2);
+        hl->capacity *= 2;
+        hl->nodes = (hl_node_t*)realloc(hl->nodes, hl->capacity * sizeof(hl_node_t));
+        assert(hl->nodes != NULL);
+    }
+    n = hl->nnodes++;
+    node = &hl->nodes[n];
+    node->child[0] = nw;
+    node->child[1] = ne;
+    node->child[2] = sw;
+    node->child[3] = se;
+    node->level = hl->nodes[nw].level + 1;
+    node->result = HL_NIL;
+    node->next = hl->bucket[h];
+    hl->bucket[h] = n;
+    return n;
+}
+
+/* Quadtree of level k for the square of `grid` (row stride `stride`)
+   whose top left corner is `grid` itself */
+uint32_t hl_build( hashlife_t *hl, const cell_t *grid, size_t stride, int k )
+{
+    const size_t half = (size_t)1 << (k-1);
+    uint32_t nw, ne, sw, se;
+
+    if (k == 0)
+        return *grid;
+    nw = hl_build(hl, grid, stride, k-1);
+    ne = hl_build(hl, grid + half, stride, k-1);
+    sw = hl_build(hl, grid + half*stride, stride, k-1);
+    se = hl_build(hl, grid + half*stride + half, stride, k-1);
+    return hl_join(hl, nw, ne, sw, se);
+}
+
+/* Write the square represented by node `n` into `grid` */
+void hl_flatten( const hashlife_t *hl, uint32_t n, cell_t *grid, size_t stride )
+{
+    const hl_node_t *node = &hl->nodes[n];
+    size_t half;
+
+    if (node->level == 0) {
+        *grid = (cell_t)n;
+        return;
+    }
+    half = (size_t)1 << (node->level - 1);
+    hl_flatten(hl, node->child[0], grid, stride);
+    hl_flatten(hl, node->child[1], grid + half, stride);
+    hl_flatten(hl, node->child[2], grid + half*stride, stride);
+    hl_flatten(hl, node->child[3], grid + half*stride + half, stride);
+}
+
+/* Apply the HPP rule to the block whose cells are a, b, c, d, laid
+   out as in step() */
+void block_rule( cell_t *a, cell_t *b, cell_t *c, cell_t *d )
+{
+    if ((((*a == EMPTY) != (*b == EMPTY)) &&
+         ((*c == EMPTY) != (*d == EMPTY))) ||
+        (*a == WALL) || (*b == WALL) ||
+        (*c == WALL) || (*d == WALL)) {
+        swap_cells(a, b);
+        swap_cells(c, d);
+    } else {
+        swap_cells(a, d);
+        swap_cells(b, c);
+    }
+}
+
+/* Base case: the central 4x4 square of the 8x8 node `n` after one step */
+uint32_t hl_base( hashlife_t *hl, uint32_t n )
+{
+    cell_t g[8][8];
+    int i, j;
+
+    hl_flatten(hl, n, &g[0][0], 8);
+    for (i=0; i<8; i+=2) {
+        for (j=0; j<8; j+=2) {
+            block_rule(&g[i][j], &g[i][j+1], &g[i+1][j], &g[i+1][j+1]);
+        }
+    }
+    for (i=2; i<8; i+=2) {
+        for (j=2; j<8; j+=2) {
+            block_rule(&g[i][j], &g[i][j-1], &g[i-1][j], &g[i-1][j-1]);
+        }
+    }
+    return hl_build(hl, &g[2][2], 8, 2);
+}
+
+/* Central square (level k-1) of the level k node `n` */
+uint32_t hl_centre( hashlife_t *hl, uint32_t n )
+{
+    const uint32_t *c = hl->nodes[n].child;
+    const uint32_t nw = hl->nodes[c[0]].child[3];
+    const uint32_t ne = hl->nodes[c[1]].child[2];
+    const uint32_t sw = hl->nodes[c[2]].child[1];
+    const uint32_t se = hl->nodes[c[3]].child[0];
+    return hl_join(hl, nw, ne, sw, se);
+}
+
+/* Central square (level k-1) of the level k node `n` advanced by 2^j
+   steps, with 0 <= j <= k-3 */
+uint32_t hl_advance( hashlife_t *hl, uint32_t n, uint32_t j )
+{
+    const uint32_t k = hl->nodes[n].level;
+    hl_memo_t *e = &hl->memo[hl_hash(n, j, 0, 0) & (hl->nmemo - 1)];
+    uint32_t c[4], g[4][4], sub[9], res;
+    int q;
+
+    assert(k >= 3 && j + 3 <= k);
+    if (j + 3 == k && hl->nodes[n].result != HL_NIL) {
+        hl->hits++;
+        return hl->nodes[n].result;
+    }
+    if (j + 3 < k && e->node == n && e->j == j) {
+        hl->hits++;
+        return e->result;
+    }
+    hl->misses++;
+
+    if (k == 3) {
+        res = hl_base(hl, n);
+    } else {
+        for (q=0; q<4; q++) {
+            c[q] = hl->nodes[n].child[q];
+        }
+        for (q=0; q<4; q++) {
+            memcpy(g[q], hl->nodes[c[q]].child, sizeof(g[q]));
+        }
+        /* nine overlapping sub-squares of level k-1 */
+        sub[0] = c[0];
+        sub[1] = hl_join(hl, g[0][1], g[1][0], g[0][3], g[1][2]);
+        sub[2] = c[1];
+        sub[3] = hl_join(hl, g[0][2], g[0][3], g[2][0], g[2][1]);
+        sub[4] = hl_join(hl, g[0][3], g[1][2], g[2][1], g[3][0]);
+        sub[5] = hl_join(hl, g[1][2], g[1][3], g[3][0], g[3][1]);
+        sub[6] = c[2];
+        sub[7] = hl_join(hl, g[2][1], g[3][0], g[2][3], g[3][2]);
+        sub[8] = c[3];
+        /* first half of the steps (or none, if fewer steps are asked) */
+        for (q=0; q<9; q++) {
+            sub[q] = (j + 3 == k) ? hl_advance(hl, sub[q], j-1) : hl_centre(hl, sub[q]);
+        }
+        /* second half on the four level k-1 squares they form */
+        {
+            const uint32_t jj = (j + 3 == k) ? j-1 : j;
+            const uint32_t nw = hl_advance(hl, hl_join(hl, sub[0], sub[1], sub[3], sub[4]), jj);
+            const uint32_t ne = hl_advance(hl, hl_join(hl, sub[1], sub[2], sub[4], sub[5]), jj);
+            const uint32_t sw = hl_advance(hl, hl_join(hl, sub[3], sub[4], sub[6], sub[7]), jj);
+            const uint32_t se = hl_advance(hl, hl_join(hl, sub[4], sub[5], sub[7], sub[8]), jj);
+            res = hl_join(hl, nw, ne, sw, se);
+        }
+    }
+
+    if (j + 3 == k) {
+        hl->nodes[n].result = res;
+    } else {
+        /* the recursion may have reused the slot */
+        if (e->node != HL_NIL && !(e->node == n && e->j == j))
+            hl->evictions++;
+        e->node = n;
+        e->j = j;
+        e->result = res;
+    }
+    return res;
+}
+
+/* Advance the N*N torus `grid` (N=2^m, m >= 3) by `nsteps` steps with
+   the HashLife engine; returns the elapsed time */
+double run_hashlife( cell_t *grid, int N, int nsteps, const hashlife_options_t *opt )
+{
+    hashlife_t hl;
+    int m = 0, t = 0;
+    uint32_t u;
+    double tstart, tstop;
+
+    while ((1 << m) < N)
+        m++;
+    assert((1 << m) == N && m >= 3);
+
+    tstart = omp_get_wtime();
+    hl_init(&hl, opt);
+    u = hl_build(&hl, grid, N, m);
+    while (t < nsteps) {
+        /* largest 2^j <= nsteps - t allowed by the 2N macrocell: it has
+           level m+1, so j <= m-2 (N/4 steps) */
+        uint32_t j = 0;
+        while (j < (uint32_t)m - 2 && (2 << j) <= nsteps - t)
+            j++;
+        if (hl.nnodes > hl.max_nodes) {
+            hl_flatten(&hl, u, grid, N);
+            hl_reset(&hl);
+            hl.flushes++;
+            u = hl_build(&hl, grid, N, m);
+        }
+        {
+            const uint32_t *c = hl.nodes[u].child;
+            const uint32_t rolled = hl_join(&hl, c[3], c[2], c[1], c[0]);
+            const uint32_t big = hl_join(&hl, rolled, rolled, rolled, rolled);
+            u = hl_advance(&hl, big, j);
+        }
+        t += 1 << j;
+        hpp_stats_step(stats, t);
+    }
+    hl_flatten(&hl, u, grid, N);
+    tstop = omp_get_wtime();
+
+    printf("HashLife: %u nodes, memo hits %llu misses %llu evictions %llu, "
+           "%d flushes (%llu nodes dropped)\n",
+           hl.nnodes, hl.hits, hl.misses, hl.evictions, hl.flushes, hl.flushed_nodes);
+    hl_free(&hl);
+    return tstop - tstart;
+}
+
+/**
+ ** Sparse engine for very low density gas. Only the gas cells are
+ ** stored, as the sorted list of their columns row by row (CSR layout:
+ ** the columns of row r are col[row_start[r] .. row_start[r+1]-1]); the
+ ** walls, which never move, are a static bitmap. Each phase merges the
+ ** two rows of every block row and updates only the blocks that contain
+ ** gas. Blocks conserve their particles, so the gas of a pair of rows
+ ** stays in the same slice of the list and pairs are updated in
+ ** parallel. The cost is proportional to the number of particles
+ ** instead of Nx*Ny.
+ **/
+typedef struct {
+    int Nx, Ny;
+    size_t ngas;
+    size_t *row_start, *next_row_start;   /* Ny+1 offsets */
+    int *col, *next_col;                  /* ngas columns */
+    uint64_t *walls;                      /* Nx*Ny bits */
+    /* block rule of each phase as a table: the index is the wall mask
+       of the block shifted left by 4 plus its gas mask (bit 0 top-left,
+       1 top-right, 2 bottom-left, 3 bottom-right), the entry is the new
+       gas mask */
+    unsigned char rule[2][256];
+} sparse_t;
+
+unsigned sparse_is_wall( const sparse_t *sp, int i, int j )
+{
+    const size_t ij = (size_t)i*sp->Nx + j;
+    return (unsigned)(sp->walls[ij >> 6] >> (ij & 63)) & 1;
+}
+
+/* Tabulate block_rule() for both phases, see sparse_t */
+void sparse_build_rule( sparse_t *sp )
+{
+    int idx, q;
+
+    for (idx=0; idx<256; idx++) {
+        cell_t even[4], odd[4];
+        for (q=0; q<4; q++) {
+            even[q] = ((idx >> (4+q)) & 1) ? WALL : (((idx >> q) & 1) ? GAS : EMPTY);
+            odd[q] = even[q];
+        }
+        /* same a, b, c, d as step() */
+        block_rule(&even[0], &even[1], &even[2], &even[3]);
+        block_rule(&odd[3], &odd[2], &odd[1], &odd[0]);
+        sp->rule[0][idx] = sp->rule[1][idx] = 0;
+        for (q=0; q<4; q++) {
+            sp->rule[0][idx] |= (even[q] == GAS) << q;
+            sp->rule[1][idx] |= (odd[q] == GAS) << q;
+        }
+    }
+}
+
+void sparse_from_grid( sparse_t *sp, const cell_t *grid, int Nx, int Ny )
+{
+    const size_t nwords = ((size_t)Nx*Ny + 63) / 64;
+    size_t k = 0, ij;
+    int i, j;
+
+    sp->Nx = Nx;
+    sp->Ny = Ny;
+    sparse_build_rule(sp);
+    sp->ngas = 0;
+    for (ij=0; ij<(size_t)Nx*Ny; ij++)
+        sp->ngas += (grid[ij] == GAS);
+    sp->row_start = (size_t*)malloc((Ny+1) * sizeof(size_t));
+    sp->next_row_start = (size_t*)malloc((Ny+1) * sizeof(size_t));
+    sp->col = (int*)malloc((sp->ngas + 1) * sizeof(int));
+    sp->next_col = (int*)malloc((sp->ngas + 1) * sizeof(int));
+    sp->walls = (uint64_t*)calloc(nwords, sizeof(uint64_t));
+    assert(sp->row_start != NULL && sp->next_row_start != NULL);
+    assert(sp->col != NULL && sp->next_col != NULL && sp->walls != NULL);
+    for (i=0; i<Ny; i++) {
+        sp->row_start[i] = k;
+        for (j=0; j<Nx; j++) {
+            ij = (size_t)i*Nx + j;
+            if (grid[ij] == GAS)
+                sp->col[k++] = j;
+            else if (grid[ij] == WALL)
+                sp->walls[ij >> 6] |= (uint64_t)1 << (ij & 63);
+        }
+    }
+    sp->row_start[Ny] = k;
+}
+
+void sparse_to_grid( const sparse_t *sp, cell_t *grid )
+{
+    const int Nx = sp->Nx, Ny = sp->Ny;
+    int i;
+
+    #pragma omp parallel for default(shared)
+    for (i=0; i<Ny; i++) {
+        size_t k;
+        int j;
+        for (j=0; j<Nx; j++)
+            grid[(size_t)i*Nx + j] = sparse_is_wall(sp, i, j) ? WALL : EMPTY;
+        for (k=sp->row_start[i]; k<sp->row_start[i+1]; k++)
+            grid[(size_t)i*Nx + sp->col[k]] = GAS;
+    }
+}
+
+void sparse_free( sparse_t *sp )
+{
+    free(sp->row_start);
+    free(sp->next_row_start);
+    free(sp->col);
+    free(sp->next_col);
+    free(sp->walls);
+}
+
+/* Block column of column j; in the odd phase the blocks are shifted
+   left by one and column Nx-1 belongs to block 0 */
+int sparse_block( int j, int Nx, phase_t phase )
+{
+    if (phase == EVEN_PHASE)
+        return j / 2;
+    return (j == Nx-1) ? 0 : (j + 1) / 2;
+}
+
+/* k-th column of a row in block order: with `rot` set the last column
+   (Nx-1) comes first */
+int sparse_nth( const int *cols, size_t n, size_t rot, size_t k )
+{
+    return rot ? cols[k == 0 ? n-1 : k-1] : cols[k];
+}
+
+/* Update the blocks of the pair of rows (r0 on top, r1 below) whose gas
+   columns are cols0[0..n0-1] and cols1[0..n1-1]; the new columns are
+   stored in out0/out1 and their number returned in m0 and m1. Rows are
+   kept sorted: in the odd phase column Nx-1 (block 0) is visited first
+   and moved back to the end of the row afterwards. */
+void sparse_update_pair( const sparse_t *sp, phase_t phase, int r0, int r1,
+                         const int *cols0, size_t n0, const int *cols1, size_t n1,
+                         int *out0, size_t *m0, int *out1, size_t *m1 )
+{
+    const int Nx = sp->Nx;
+    const unsigned char *rule = sp->rule[phase == ODD_PHASE];
+    const size_t rot0 = (phase == ODD_PHASE && n0 > 0 && cols0[n0-1] == Nx-1);
+    const size_t rot1 = (phase == ODD_PHASE && n1 > 0 && cols1[n1-1] == Nx-1);
+    size_t i0 = 0, i1 = 0, k0 = 0, k1 = 0;
+
+    while (i0 < n0 || i1 < n1) {
+        const int j0 = (i0 < n0) ? sparse_nth(cols0, n0, rot0, i0) : -1;
+        const int j1 = (i1 < n1) ? sparse_nth(cols1, n1, rot1, i1) : -1;
+        const int bc0 = (j0 >= 0) ? sparse_block(j0, Nx, phase) : Nx;
+        const int bc1 = (j1 >= 0) ? sparse_block(j1, Nx, phase) : Nx;
+        const int bc = (bc0 < bc1) ? bc0 : bc1;
+        /* left and right column of the block */
+        const int cl = (phase == EVEN_PHASE) ? 2*bc : (bc == 0 ? Nx-1 : 2*bc - 1);
+        const int cr = (phase == EVEN_PHASE) ? 2*bc + 1 : 2*bc;
+        unsigned gas = 0, walls, out;
+
+        /* a row holds at most two cells of the block, left one first */
+        if (bc0 == bc) {
+            gas |= (j0 == cl) ? 1 : 2;
+            i0++;
+            if (j0 == cl && i0 < n0 && sparse_nth(cols0, n0, rot0, i0) == cr) {
+                gas |= 2;
+                i0++;
+            }
+        }
+        if (bc1 == bc) {
+            gas |= (j1 == cl) ? 4 : 8;
+            i1++;
+            if (j1 == cl && i1 < n1 && sparse_nth(cols1, n1, rot1, i1) == cr) {
+                gas |= 8;
+                i1++;
+            }
+        }
+        walls = sparse_is_wall(sp, r0, cl) | (sparse_is_wall(sp, r0, cr) << 1) |
+                (sparse_is_wall(sp, r1, cl) << 2) | (sparse_is_wall(sp, r1, cr) << 3);
+        out = rule[(walls << 4) | gas];
+        /* branchless append, the buffers have room for a spare write */
+        out0[k0] = cl; k0 += out & 1;
+        out0[k0] = cr; k0 += (out >> 1) & 1;
+        out1[k1] = cl; k1 += (out >> 2) & 1;
+        out1[k1] = cr; k1 += (out >> 3) & 1;
+    }
+    /* column Nx-1 of block 0 goes back to the end of the row */
+    if (phase == ODD_PHASE && k0 > 0 && out0[0] == Nx-1) {
+        memmove(out0, out0 + 1, (k0 - 1) * sizeof(int));
+        out0[k0 - 1] = Nx-1;
+    }
+    if (phase == ODD_PHASE && k1 > 0 && out1[0] == Nx-1) {
+        memmove(out1, out1 + 1, (k1 - 1) * sizeof(int));
+        out1[k1 - 1] = Nx-1;
+    }
+    *m0 = k0;
+    *m1 = k1;
+}
+
+/* One phase of the sparse engine */
+void sparse_step( sparse_t *sp, phase_t phase )
+{
+    const int Nx = sp->Nx, Ny = sp->Ny;
+    const size_t *rs = sp->row_start;
+    size_t *nrs = sp->next_row_start;
+    ptrdiff_t shift = 0;
+    int *tmp;
+
+    if (phase == ODD_PHASE) {
+        /* the pair (Ny-1, 0) wraps around: row 0 may change length and
+           shift every other row of the new list */
+        size_t m0, m1;
+        int *out = (int*)malloc((4*(size_t)Nx + 1) * sizeof(int));
+        assert(out != NULL);
+        sparse_update_pair(sp, phase, Ny-1, 0,
+                           &sp->col[rs[Ny-1]], rs[Ny] - rs[Ny-1], &sp->col[rs[0]], rs[1] - rs[0],
+                           out, &m0, out + 2*Nx, &m1);
+        memcpy(&sp->next_col[0], out + 2*Nx, m1 * sizeof(int));
+        memcpy(&sp->next_col[sp->ngas - m0], out, m0 * sizeof(int));
+        nrs[0] = 0;
+        nrs[Ny-1] = sp->ngas - m0;
+        shift = (ptrdiff_t)m1 - (ptrdiff_t)(rs[1] - rs[0]);
+        free(out);
+    }
+    nrs[Ny] = sp->ngas;
+
+    #pragma omp parallel default(shared)
+    {
+        int *out = (int*)malloc((4*(size_t)Nx + 1) * sizeof(int));
+        int m;
+        assert(out != NULL);
+        /* pairs (2m, 2m+1) in the even phase, (2m-1, 2m) in the odd one */
+        #pragma omp for schedule(dynamic,64)
+        for (m=(phase == EVEN_PHASE ? 0 : 1); m<Ny/2; m++) {
+            const int r0 = (phase == EVEN_PHASE) ? 2*m : 2*m - 1;
+            const int r1 = r0 + 1;
+            const size_t off = rs[r0] + shift;
+            size_t m0, m1;
+            sparse_update_pair(sp, phase, r0, r1,
+                               &sp->col[rs[r0]], rs[r1] - rs[r0], &sp->col[rs[r1]], rs[r1+1] - rs[r1],
+                               out, &m0, out + 2*Nx, &m1);
+            memcpy(&sp->next_col[off], out, m0 * sizeof(int));
+            memcpy(&sp->next_col[off + m0], out + 2*Nx, m1 * sizeof(int));
+            nrs[r0] = off;
+            nrs[r1] = off + m0;
+        }
+        free(out);
+    }
+
+    tmp = sp->col; sp->col = sp->next_col; sp->next_col = tmp;
+    sp->next_row_start = sp->row_start;
+    sp->row_start = nrs;
+}
+
+/* Advance `grid` by `nsteps` steps with the sparse engine; returns the
+   elapsed time */
+double run_sparse( cell_t *grid, int Nx, int Ny, int nsteps )
+{
+    sparse_t sp;
+    int t;
+    double tstart, tstop;
+
+    tstart = omp_get_wtime();
+    sparse_from_grid(&sp, grid, Nx, Ny);
+    for (t=0; t<nsteps; t++) {
+        const uint64_t t0 = hpp_stats_now();
+        sparse_step(&sp, EVEN_PHASE);
+        const uint64_t t1 = hpp_stats_now();
+        sparse_step(&sp, ODD_PHASE);
+        hpp_stats_phase(stats, 0, t1 - t0);
+        hpp_stats_phase(stats, 1, hpp_stats_now() - t1);
+        hpp_stats_step(stats, t+1);
+    }
+    sparse_to_grid(&sp, grid);
+    tstop = omp_get_wtime();
+    sparse_free(&sp);
+    return tstop - tstart;
+}
+
+/* Fraction of gas cells. HPP conserves the particles, so the density
+   measured on the initial grid holds for the whole run */
+double gas_density( const cell_t *grid, int Nx, int Ny )
+{
+    size_t ij, ngas = 0;
+
+    #pragma omp parallel for default(shared) reduction(+:ngas)
+    for (ij=0; ij<(size_t)Nx*Ny; ij++)
+        ngas += (grid[ij] == GAS);
+    return (double)ngas / ((double)Nx*Ny);
+}
+
+/* Parse the size of the domain, "N" for a N*N square or "NxM" for N
+   columns (Nx) by M rows (Ny); returns 0 if both sides are even and
+   positive */
+int parse_size( const char *s, int *Nx, int *Ny )
+{
+    char *end;
+    long nx, ny;
+
+    nx = strtol(s, &end, 10);
+    ny = nx;
+    if (*end == 'x') {
+        ny = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || nx < 2 || ny < 2 || nx % 2 != 0 || ny % 2 != 0 ||
+        nx > (1L << 30) || ny > (1L << 30)) {
+        return -1;
+    }
+    *Nx = (int)nx;
+    *Ny = (int)ny;
+    return 0;
+}
+
+/**
+ ** Ensemble mode: many independent simulations in the same process.
+ ** Each line of the manifest describes a job as
+ **
+ **     input N S seed
+ **
+ ** where N is a size as on the command line, N or NxM (empty lines
+ ** and lines starting with '#' are ignored). Output files of job k are
+ ** named "ensKKK-hppNNNNN.pgm".
+ **/
+typedef struct {
+    char input[256];
+    int Nx, Ny, nsteps;
+    unsigned seed;
+    double cost;        /* estimated work: Nx*Ny*S cell updates */
+} job_t;
+
+/* Read the manifest; returns the number of jobs, stored in `*jobs` */
+int read_manifest( const char *fname, job_t **jobs )
+{
+    FILE *f;
+    char line[512];
+    int njobs = 0, cap = 16;
+
+    if ((f = fopen(fname, "r")) == NULL) {
+        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    *jobs = (job_t*)malloc(cap * sizeof(job_t));
+    assert(*jobs != NULL);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        job_t *job;
+        char first, size[32];
+
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+            continue;
+        if (njobs == cap) {
+            cap *= 2;
+            *jobs = (job_t*)realloc(*jobs, cap * sizeof(job_t));
+            assert(*jobs != NULL);
+        }
+        job = &(*jobs)[njobs];
+        if (sscanf(line, "%255s %31s %d %u", job->input, size, &job->nsteps, &job->seed) != 4) {
+            fprintf(stderr, "FATAL: malformed manifest line `%s`\n", line);
+            exit(EXIT_FAILURE);
+        }
+        if (parse_size(size, &job->Nx, &job->Ny) != 0) {
+            fprintf(stderr, "FATAL: the sides of the domain must be even (job %d)\n", njobs);
+            exit(EXIT_FAILURE);
+        }
+        job->cost = (double)job->Nx * job->Ny * (job->nsteps > 0 ? job->nsteps : 1);
+        njobs++;
+    }
+    fclose(f);
+    return njobs;
+}
+
+/* Load and run job `k`, printing its timing; returns 0 on success */
+int run_job( const job_t *job, int k, const char *cache_dir )
+{
+    FILE *filein;
+    char prefix[32];
+    const size_t GRID_SIZE = (size_t)job->Nx*job->Ny*sizeof(cell_t);
+    cell_t *cur, *next;
+    double elapsed;
+
+    if ((filein = fopen(job->input, "r")) == NULL) {
+        fprintf(stderr, "job %d: can not open \"%s\" for reading\n", k, job->input);
+        return -1;
+    }
+    cur = (cell_t*)malloc(GRID_SIZE);
+    assert(cur != NULL);
+    next = (cell_t*)malloc(GRID_SIZE);
+    assert(next != NULL);
+
+    /* the PRNG is shared: seeding and drawing must not interleave */
+#pragma omp critical(prng)
+    load_problem(filein, cur, job->Nx, job->Ny, job->seed, cache_dir);
+    fclose(filein);
+
+    snprintf(prefix, sizeof(prefix), "ens%03d-hpp", k);
+    elapsed = run_simulation(cur, next, job->Nx, job->Ny, job->nsteps, prefix);
+    printf("job %d (%s N=%dx%d S=%d seed=%u): elapsed time %f\n",
+           k, job->input, job->Nx, job->Ny, job->nsteps, job->seed, elapsed);
+    free(cur);
+    free(next);
+    return 0;
+}
+
+static const job_t *sort_jobs_base;
+
+/* Orders job indices by decreasing cost */
+int cmp_job_cost( const void *a, const void *b )
+{
+    const double ca = sort_jobs_base[*(const int*)a].cost;
+    const double cb = sort_jobs_base[*(const int*)b].cost;
+    return (ca < cb) - (ca > cb);
+}
+
+/* Run all jobs of the manifest on the thread pool. Jobs whose cost
+   exceeds a fair share of the total run one at a time using all the
+   threads (inside `step`); the remaining small jobs are packed onto
+   the threads, one job per thread, largest first. Returns the number
+   of failed jobs. */
+int run_ensemble( const char *manifest, const char *cache_dir )
+{
+    job_t *jobs;
+    int *order;
+    int njobs, nlarge = 0, nfailed = 0, k;
+    const int nthreads = omp_get_max_threads();
+    double total = 0.0;
+    double tstart, tstop;
+
+    njobs = read_manifest(manifest, &jobs);
+    order = (int*)malloc((njobs > 0 ? njobs : 1) * sizeof(int));
+    assert(order != NULL);
+    for (k=0; k<njobs; k++) {
+        order[k] = k;
+        total += jobs[k].cost;
+    }
+    sort_jobs_base = jobs;
+    qsort(order, njobs, sizeof(int), cmp_job_cost);
+    while (nlarge < njobs && jobs[order[nlarge]].cost > total / nthreads)
+        nlarge++;
+
+    /* a job running on a single thread must not open a nested team */
+    omp_set_max_active_levels(1);
+
+    tstart = omp_get_wtime();
+    for (k=0; k<nlarge; k++) {
+        if (run_job(&jobs[order[k]], order[k], cache_dir) != 0)
+            nfailed++;
+    }
+#pragma omp parallel for schedule(dynamic,1) reduction(+:nfailed)
+    for (k=nlarge; k<njobs; k++) {
+        if (run_job(&jobs[order[k]], order[k], cache_dir) != 0)
+            nfailed++;
+    }
+    tstop = omp_get_wtime();
+    printf("Ensemble: %d jobs (%d on the whole pool), elapsed time: %f \n",
+           njobs, nlarge, tstop - tstart);
+
+    free(order);
+    free(jobs);
+    return nfailed;
+}
+
+/**
+ ** Command line program; libhpp.c includes this file with HPP_LIBRARY
+ ** defined to reuse everything above without main().
+ **/
+#ifndef HPP_LIBRARY
+typedef enum {
+    ENGINE_AUTO,        /* sparse below SPARSE_MAX_DENSITY, dense otherwise */
+    ENGINE_DENSE,
+    ENGINE_SPARSE,
+    ENGINE_HASHLIFE
+} engine_t;
+
+/* Gas density under which the sparse engine beats the dense sweep */
+#define SPARSE_MAX_DENSITY 0.08
+
+/**
+ ** Autotuning of the dense engine (--autotune): short timed trials on
+ ** a copy of the initial grid, one parameter at a time (kernel, then
+ ** threads, then schedule of the rows), which takes about 15 trials
+ ** instead of the ~100 of every combination. The fastest configuration
+ ** is stored in the tuning cache of the host (hpp-tune.h) under
+ ** "omp NxxNy", and the next runs of the same size load it at startup.
+ **/
+
+/* Target duration of a trial, in seconds */
+#define TUNE_TRIAL_TIME 0.05
+
+const char *kernel_name( kernel_t k )
+{
+    return (k == KERNEL_ROWS) ? "rows" : "generic";
+}
+
+const char *schedule_name( omp_sched_t s )
+{
+    switch (s) {
+    case omp_sched_static: return "static";
+    case omp_sched_dynamic: return "dynamic";
+    case omp_sched_guided: return "guided";
+    default: return "auto";
+    }
+}
+
+/* Parse a line of the tuning cache; returns 0 if it is valid */
+int parse_tuning( const char *value, tuning_t *t )
+{
+    char kname[16], sname[16];
+
+    if (sscanf(value, "%15s %d %15s %d", kname, &t->nthreads, sname, &t->chunk) != 4 ||
+        t->nthreads < 1 || t->chunk < 0) {
+        return -1;
+    }
+    if (strcmp(kname, "generic") == 0) {
+        t->kernel = KERNEL_GENERIC;
+    } else if (strcmp(kname, "rows") == 0) {
+        t->kernel = KERNEL_ROWS;
+    } else {
+        return -1;
+    }
+    if (strcmp(sname, "static") == 0) {
+        t->schedule = omp_sched_static;
+    } else if (strcmp(sname, "dynamic") == 0) {
+        t->schedule = omp_sched_dynamic;
+    } else if (strcmp(sname, "guided") == 0) {
+        t->schedule = omp_sched_guided;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Load the configuration stored for a Nx*Ny domain, if any.
+   OMP_NUM_THREADS and OMP_SCHEDULE, when set, win over the cache. */
+void tune_load( int Nx, int Ny )
+{
+    char key[64], value[HPP_TUNE_LINE];
+    tuning_t t = tuning;
+
+    if (getenv("OMP_SCHEDULE") != NULL) {
+        omp_get_schedule(&tuning.schedule, &tuning.chunk);
+    }
+    snprintf(key, sizeof(key), "omp %dx%d", Nx, Ny);
+    if (hpp_tune_lookup(key, value, sizeof(value)) != 0 || parse_tuning(value, &t) != 0) {
+        return;
+    }
+    if (getenv("OMP_SCHEDULE") != NULL) {
+        t.schedule = tuning.schedule;
+        t.chunk = tuning.chunk;
+    }
+    if (getenv("OMP_NUM_THREADS") == NULL) {
+        omp_set_num_threads(t.nthreads);
+    }
+    tuning = t;
+}
+
+/* Seconds per step of configuration `t`: the best of three runs of
+   `nsteps` steps from `grid`, on the scratch grids a and b */
+double tune_trial( const tuning_t *t, const cell_t *grid, cell_t *a, cell_t *b,
+                   int Nx, int Ny, int nsteps )
+{
+    double best = 0;
+    int r, s;
+
+    tuning = *t;
+    omp_set_num_threads(t->nthreads);
+    for (r=0; r<3; r++) {
+        memcpy(a, grid, (size_t)Nx*Ny);
+        const double t0 = omp_get_wtime();
+        for (s=0; s<nsteps; s++) {
+            step(a, b, Nx, Ny, EVEN_PHASE);
+            step(b, a, Nx, Ny, ODD_PHASE);
+        }
+        const double elapsed = (omp_get_wtime() - t0) / nsteps;
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/* Time `cand` and make it the best if it is faster */
+void tune_try( const tuning_t *cand, tuning_t *best, double *tbest, const cell_t *grid,
+               cell_t *a, cell_t *b, int Nx, int Ny, int nsteps )
+{
+    const double tc = tune_trial(cand, grid, a, b, Nx, Ny, nsteps);
+
+    printf("autotune: kernel=%s threads=%d schedule=%s,%d: %.3f ns per cell\n",
+           kernel_name(cand->kernel), cand->nthreads, schedule_name(cand->schedule),
+           cand->chunk, tc * 1e9 / ((double)Nx*Ny));
+    if (tc < *tbest) {
+        *best = *cand;
+        *tbest = tc;
+    }
+}
+
+/* Choose the fastest configuration for `grid`, apply it and store it
+   in the tuning cache */
+void autotune( const cell_t *grid, int Nx, int Ny )
+{
+    /* schedules tried, with the chunk in pairs of rows */
+    static const struct { omp_sched_t schedule; int chunk; } scheds[] = {
+        {omp_sched_static, 0}, {omp_sched_static, 1}, {omp_sched_static, 8},
+        {omp_sched_dynamic, 1}, {omp_sched_dynamic, 8}, {omp_sched_dynamic, 64},
+        {omp_sched_guided, 1}
+    };
+    const int nprocs = omp_get_num_procs();
+    tuning_t best = { KERNEL_GENERIC, nprocs, omp_sched_static, 0 }, cand;
+    cell_t *a = (cell_t*)malloc((size_t)Nx*Ny);
+    cell_t *b = (cell_t*)malloc((size_t)Nx*Ny);
+    char key[64], value[HPP_TUNE_LINE];
+    double tbest, tuntuned;
+    int nsteps, k, n;
+
+    assert(a != NULL && b != NULL);
+    /* steps per trial: about TUNE_TRIAL_TIME with the initial configuration */
+    tbest = tune_trial(&best, grid, a, b, Nx, Ny, 1);
+    nsteps = (int)(TUNE_TRIAL_TIME / (tbest > 1e-9 ? tbest : 1e-9));
+    nsteps = (nsteps < 1) ? 1 : (nsteps > 1000 ? 1000 : nsteps);
+    tbest = HUGE_VAL;
+    tune_try(&best, &best, &tbest, grid, a, b, Nx, Ny, nsteps);
+    tuntuned = tbest;
+
+    for (k=KERNEL_GENERIC; k<=KERNEL_ROWS; k++) {
+        cand = best;
+        cand.kernel = (kernel_t)k;
+        if (cand.kernel != best.kernel) {
+            tune_try(&cand, &best, &tbest, grid, a, b, Nx, Ny, nsteps);
+        }
+    }
+    for (n=1; n<nprocs; n*=2) {
+        cand = best;
+        cand.nthreads = n;
+        tune_try(&cand, &best, &tbest, grid, a, b, Nx, Ny, nsteps);
+    }
+    for (k=0; k<(int)(sizeof(scheds)/sizeof(scheds[0])); k++) {
+        cand = best;
+        cand.schedule = scheds[k].schedule;
+        cand.chunk = scheds[k].chunk;
+        if ((cand.schedule != best.schedule || cand.chunk != best.chunk) && cand.chunk <= Ny/2) {
+            tune_try(&cand, &best, &tbest, grid, a, b, Nx, Ny, nsteps);
+        }
+    }
+    free(a);
+    free(b);
+
+    tuning = best;
+    omp_set_num_threads(best.nthreads);
+    printf("autotune: best kernel=%s threads=%d schedule=%s,%d (%.3f ns per cell, %.2fx "
+           "faster than untuned)\n", kernel_name(best.kernel), best.nthreads,
+           schedule_name(best.schedule), best.chunk, tbest * 1e9 / ((double)Nx*Ny),
+           tuntuned / tbest);
+    snprintf(key, sizeof(key), "omp %dx%d", Nx, Ny);
+    snprintf(value, sizeof(value), "%s %d %s %d %.3f", kernel_name(best.kernel), best.nthreads,
+             schedule_name(best.schedule), best.chunk, tbest * 1e9 / ((double)Nx*Ny));
+    if (hpp_tune_store(key, value) != 0) {
+        fprintf(stderr, "WARNING: can not write the tuning cache: %s\n", strerror(errno));
+    }
+}
+
+/* Optional command line arguments */
+typedef struct {
+    engine_t engine;        /* simulation engine */
+    hashlife_options_t hl;  /* tuning of the HashLife engine */
+    const char *manifest;   /* ensemble mode (NULL if not requested) */
+    ooc_options_t ooc;      /* out-of-core mode (ooc.dir == NULL if not requested) */
+    const char *cache_dir;  /* scenario cache (NULL if not requested) */
+    int perf_counters;      /* profile the dense engine with hardware counters */
+    int autotune;           /* time the configurations of the dense engine first */
+    hpp_alloc_policy_t mem; /* huge pages and NUMA placement of the grids */
+    const char *stats_name; /* telemetry segment (NULL if not requested) */
+    int delta_keyint;       /* keyframe interval of the frame stream (0 = PGM files) */
+    int preview_side;       /* side of the preview mipmap (0 = none) */
+    const char *roi;        /* "x,y,w,h" of the full resolution crop (NULL = none) */
+    const char *single_run; /* last option that the ensemble jobs do not honour (or NULL) */
+    const char *in_memory;  /* last option that --ooc does not honour (or NULL) */
+} options_t;
+
+/* Parse the value of --hl-nodes or --hl-memo; returns 0 if it is a
+   number in [1, 2^30], so that the sizes derived from it fit in 32 bits */
+int parse_hl_count( const char *s, uint32_t *v )
+{
+    char *end;
+    long n;
+
+    n = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || n < 1 || n > (1L << 30)) {
+        return -1;
+    }
+    *v = (uint32_t)n;
+    return 0;
+}
+
+/* Removes the optional "--name=value" arguments (allowed anywhere)
+   from argv, leaving only the positional [N|NxM [S]] input */
+void parse_options( int *argc, char *argv[], options_t *opt )
+{
+    int i, n = 1;
+
+    opt->engine = ENGINE_AUTO;
+    opt->hl.max_nodes = 1u << 22;
+    opt->hl.memo_size = 1u << 20;
+    opt->manifest = NULL;
+    opt->ooc.dir = NULL;
+    opt->ooc.fuse = 8;
+    opt->ooc.slab_rows = 0;
+    opt->cache_dir = NULL;
+    opt->perf_counters = 0;
+    opt->autotune = 0;
+    opt->single_run = NULL;
+    opt->in_memory = NULL;
+    hpp_alloc_default(&opt->mem);
+    opt->stats_name = NULL;
+    opt->delta_keyint = 0;
+    opt->preview_side = 0;
+    opt->roi = NULL;
+    for (i=1; i<*argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            argv[n++] = argv[i];
+        } else if (strncmp(argv[i], "--ensemble=", 11) == 0) {
+            opt->manifest = argv[i] + 11;
+        } else if (strcmp(argv[i], "--engine=auto") == 0) {
+            opt->engine = ENGINE_AUTO;
+        } else if (strcmp(argv[i], "--engine=sparse") == 0) {
+            opt->engine = ENGINE_SPARSE;
+        } else if (strcmp(argv[i], "--engine=dense") == 0) {
+            opt->engine = ENGINE_DENSE;
+        } else if (strcmp(argv[i], "--engine=hashlife") == 0) {
+            opt->engine = ENGINE_HASHLIFE;
+        } else if (strncmp(argv[i], "--hl-nodes=", 11) == 0) {
+            if (parse_hl_count(argv[i] + 11, &opt->hl.max_nodes) != 0) {
+                fprintf(stderr, "FATAL: --hl-nodes must be in [1, 2^30]\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--hl-memo=", 10) == 0) {
+            if (parse_hl_count(argv[i] + 10, &opt->hl.memo_size) != 0) {
+                fprintf(stderr, "FATAL: --hl-memo must be in [1, 2^30]\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            opt->cache_dir = argv[i] + 8;
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            opt->stats_name = argv[i] + 8;
+        } else if (strncmp(argv[i], "--preview=", 10) == 0) {
+            opt->preview_side = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--roi=", 6) == 0) {
+            opt->roi = argv[i] + 6;
+        } else if (strncmp(argv[i], "--delta=", 8) == 0) {
+            opt->delta_keyint = atoi(argv[i] + 8);
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            opt->perf_counters = 1;
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            opt->autotune = 1;
+        } else if (strncmp(argv[i], "--hugepages=", 12) == 0) {
+            if (hpp_alloc_parse_huge(&opt->mem, argv[i] + 12) != 0) {
+                fprintf(stderr, "FATAL: --hugepages must be off, thp or explicit\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--numa=", 7) == 0) {
+            if (hpp_alloc_parse_numa(&opt->mem, argv[i] + 7) != 0) {
+                fprintf(stderr, "FATAL: --numa must be first-touch, interleave, bind or bind:N\n");
+                exit(EXIT_FAILURE);
+            }
+        } else if (strncmp(argv[i], "--ooc=", 6) == 0) {
+            opt->ooc.dir = argv[i] + 6;
+        } else if (strncmp(argv[i], "--fuse=", 7) == 0) {
+            opt->ooc.fuse = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--slab=", 7) == 0) {
+            opt->ooc.slab_rows = atoi(argv[i] + 7);
+        } else {
+            fprintf(stderr, "FATAL: Unrecognized option `%s`\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        /* the jobs of --ensemble run the dense engine in malloc()ed grids */
+        if ((strncmp(argv[i], "--engine=", 9) == 0 && strcmp(argv[i], "--engine=dense") != 0) ||
+            strncmp(argv[i], "--hl-", 5) == 0 || strncmp(argv[i], "--ooc=", 6) == 0 ||
+            strncmp(argv[i], "--fuse=", 7) == 0 || strncmp(argv[i], "--slab=", 7) == 0 ||
+            strcmp(argv[i], "--perf-counters") == 0 || strncmp(argv[i], "--hugepages=", 12) == 0 ||
+            strncmp(argv[i], "--numa=", 7) == 0) {
+            opt->single_run = argv[i];
+        }
+        /* --ooc runs the dense engine on file-backed slabs */
+        if (strcmp(argv[i], "--engine=sparse") == 0 || strcmp(argv[i], "--engine=hashlife") == 0 ||
+            strncmp(argv[i], "--hl-", 5) == 0 || strncmp(argv[i], "--hugepages=", 12) == 0 ||
+            strncmp(argv[i], "--numa=", 7) == 0) {
+            opt->in_memory = argv[i];
+        }
+    }
+    argv[n] = NULL;
+    *argc = n;
+}
+
+/* Create the segment of --stats, replacing a stale one left with the
+   same name; without it the run goes on, only unobserved */
+void stats_begin( hpp_stats_t *st, const char *name, int Nx, int Ny, int nsteps )
+{
+    char shm_name[256];
+
+    hpp_stats_name(shm_name, sizeof(shm_name), name);
+    shm_unlink(shm_name);
+    if (hpp_stats_create(st, shm_name, 1, Nx, Ny, nsteps) != 0) {
+        fprintf(stderr, "WARNING: can not create the stats segment \"%s\": %s\n",
+                shm_name, strerror(errno));
+        return;
+    }
+    stats = &st->slots[0];
+    hpp_stats_set(&stats->pid, (uint64_t)getpid());
+    hpp_stats_activity(stats, HPP_STATS_STEP);
+}
+
+/* Mark the run finished and remove the segment (readers that already
+   mapped it still see the final values) */
+void stats_end( hpp_stats_t *st, const char *name )
+{
+    char shm_name[256];
+
+    if (stats != NULL) {
+        hpp_stats_activity(stats, HPP_STATS_DONE);
+        stats = NULL;
+        hpp_stats_close(st);
+        hpp_stats_name(shm_name, sizeof(shm_name), name);
+        shm_unlink(shm_name);
+    }
+}
+
+/* Send the frames to the stream "<prefix>.hppd" instead of PGM files */
+void delta_begin( hpp_delta_writer_t *w, const char *prefix, int Nx, int Ny, int keyint )
+{
+    char fname[128];
+
+    snprintf(fname, sizeof(fname), "%s.hppd", prefix);
+    if (hpp_delta_open(w, fname, Nx, Ny, keyint) != 0) {
+        fprintf(stderr, "FATAL: can not create the frame stream \"%s\"\n", fname);
+        exit(EXIT_FAILURE);
+    }
+    delta = w;
+}
+
+void delta_end( hpp_delta_writer_t *w )
+{
+    const double pgm_bytes = (double)w->frames * ((double)w->Nx * w->Ny + 32);
+
+    delta = NULL;
+    if (hpp_delta_close(w) != 0) {
+        fprintf(stderr, "FATAL: error writing the frame stream\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Frame stream: %u frames, %.2f MiB (%.1fx smaller than PGM)\n", w->frames,
+           w->bytes_out / 1048576.0, pgm_bytes / w->bytes_out);
+}
+
+/* Write EMPTY on every cell with the threads and the partition of
+   step(), so that with --numa=first-touch each page lands on the node
+   of the thread that will update it (read_problem() is serial) */
+void first_touch( cell_t *grid, int Nx, int Ny )
+{
+    int i;
+
+    omp_set_schedule(tuning.schedule, tuning.chunk);
+    #pragma omp parallel for schedule(runtime)
+    for (i=0; i<Ny; i+=2) {
+        memset(grid + (size_t)i*Nx, EMPTY, (size_t)2*Nx);
+    }
+}
+
+/* Allocate a grid with the policy of --hugepages and --numa */
+cell_t *grid_alloc( int Nx, int Ny, const hpp_alloc_policy_t *pol )
+{
+    static int warned = 0;
+    hpp_alloc_status_t st;
+    cell_t *grid = (cell_t*)hpp_grid_alloc((size_t)Nx*Ny*sizeof(cell_t), pol, &st);
+
+    if (grid == NULL) {
+        fprintf(stderr, "FATAL: can not allocate a %dx%d grid\n", Nx, Ny);
+        exit(EXIT_FAILURE);
+    }
+    if ((st.missing & HPP_ALLOC_NO_HUGETLB) && !(warned & HPP_ALLOC_NO_HUGETLB)) {
+        fprintf(stderr, "WARNING: no explicit huge pages available (%s, see "
+                "/proc/sys/vm/nr_hugepages), using transparent ones\n", strerror(st.hugetlb_errno));
+    }
+    if ((st.missing & HPP_ALLOC_NO_MBIND) && !(warned & HPP_ALLOC_NO_MBIND)) {
+        fprintf(stderr, "WARNING: can not set the NUMA policy of the grids: %s\n",
+                strerror(st.mbind_errno));
+    }
+    warned |= st.missing;
+    first_touch(grid, Nx, Ny);
+    return grid;
+}
+
+int main( int argc, char* argv[] )
+{
+    int Nx, Ny, nsteps;
+    FILE *filein;
+    options_t opt;
+    hpp_stats_t st;
+    hpp_delta_writer_t dw;
+    hpp_preview_t pv;
+
+    const unsigned seed = 1234; /* Initialize PRNG deterministically */
+
+    parse_options(&argc, argv, &opt);
+
+    if (opt.manifest != NULL) {
+        if (opt.stats_name != NULL) {
+            fprintf(stderr, "WARNING: --stats is ignored in ensemble mode\n");
+        }
+        if (opt.delta_keyint != 0 || opt.preview_side != 0 || opt.roi != NULL || opt.autotune) {
+            fprintf(stderr, "FATAL: --delta, --preview, --roi and --autotune can not be used in "
+                    "ensemble mode\n");
+            return EXIT_FAILURE;
+        }
+        if (opt.single_run != NULL) {
+            fprintf(stderr, "FATAL: `%s` can not be used in ensemble mode, whose jobs run "
+                    "the dense in-memory engine\n", opt.single_run);
+            return EXIT_FAILURE;
+        }
+        return run_ensemble(opt.manifest, opt.cache_dir) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if ( (argc < 2) || (argc > 4) ) {
+        fprintf(stderr, "Usage: %s [--engine=auto|dense|sparse|hashlife] [--hl-nodes=n] [--hl-memo=n] [--cache=dir]\n"
+                "          [--ooc=dir [--fuse=T] [--slab=R]] [--perf-counters] [--autotune] [--stats=name]\n"
+                "          [--hugepages=off|thp|explicit] [--numa=first-touch|interleave|bind[:N]]\n"
+                "          [--delta=k | [--preview=S] [--roi=x,y,w,h]] [N|NxM [S]] input\n"
+                "       %s [--cache=dir] --ensemble=manifest\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 2) {
+        if (parse_size(argv[1], &Nx, &Ny) != 0) {
+            fprintf(stderr, "FATAL: the domain size must be N or NxM, with even sides\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        Nx = Ny = 512;
+    }
+
+    if (argc > 3) {
+        nsteps = atoi(argv[2]);
+    } else {
+        nsteps = 32;
+    }
+
+    if ((filein = fopen(argv[argc-1], "r")) == NULL) {
+        fprintf(stderr, "FATAL: can not open \"%s\" for reading\n", argv[argc-1]);
+        return EXIT_FAILURE;
+    }
+
+    if (opt.ooc.dir != NULL && opt.in_memory != NULL) {
+        fprintf(stderr, "FATAL: `%s` can not be used with --ooc, which runs the dense engine "
+                "on file-backed slabs\n", opt.in_memory);
+        return EXIT_FAILURE;
+    }
+
+    if (opt.engine == ENGINE_HASHLIFE) {
+        /* the macrocells are squares of side 2^k, the memo is direct-mapped */
+        if (Nx != Ny || (Nx & (Nx-1)) != 0 || Nx < 8 || opt.hl.memo_size == 0 ||
+            (opt.hl.memo_size & (opt.hl.memo_size-1)) != 0) {
+            fprintf(stderr, "FATAL: --engine=hashlife needs a square domain of side a power "
+                    "of two >= 8 and --hl-memo a power of two\n");
+            return EXIT_FAILURE;
+        }
+#ifdef DUMP_ALL
+        fprintf(stderr, "WARNING: --engine=hashlife does not dump frames, using the dense engine\n");
+#endif
+    }
+
+    if (opt.perf_counters) {
+        if (opt.ooc.dir != NULL || (opt.engine != ENGINE_AUTO && opt.engine != ENGINE_DENSE)) {
+            fprintf(stderr, "FATAL: --perf-counters profiles the dense in-memory engine only\n");
+            return EXIT_FAILURE;
+        }
+#ifdef DUMP_ALL
+        fprintf(stderr, "WARNING: --perf-counters does not dump frames\n");
+#endif
+        opt.engine = ENGINE_DENSE;
+    }
+
+    if (opt.autotune && (opt.ooc.dir != NULL || opt.engine == ENGINE_SPARSE ||
+                         opt.engine == ENGINE_HASHLIFE)) {
+        fprintf(stderr, "FATAL: --autotune tunes the dense in-memory engine only\n");
+        return EXIT_FAILURE;
+    }
+    if (opt.autotune) {
+        /* the tuned configuration must be the one that runs */
+        opt.engine = ENGINE_DENSE;
+    }
+    tune_load(Nx, Ny);
+
+    /* the 2T halo rows per side of --ooc must come from distinct rows */
+    if (opt.ooc.dir != NULL &&
+        (opt.ooc.fuse < 1 || 4*opt.ooc.fuse > Ny || opt.ooc.slab_rows % 2 != 0)) {
+        fprintf(stderr, "FATAL: --fuse must be in [1, Ny/4] and --slab even\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opt.delta_keyint < 0) {
+        fprintf(stderr, "FATAL: the keyframe interval of --delta must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opt.preview_side != 0 || opt.roi != NULL) {
+        hpp_preview_init(&pv, Nx, Ny, opt.preview_side);
+        if (opt.preview_side < 0 || (opt.preview_side == 0 && opt.roi == NULL) ||
+            (opt.roi != NULL && hpp_preview_parse_roi(&pv, opt.roi) != 0) ||
+            opt.delta_keyint != 0) {
+            fprintf(stderr, "FATAL: --preview needs a positive side, --roi a crop inside the "
+                    "grid, and they exclude --delta\n");
+            return EXIT_FAILURE;
+        }
+        preview = &pv;
+    }
+
+    if (opt.delta_keyint > 0) {
+        delta_begin(&dw, "hpp", Nx, Ny, opt.delta_keyint);
+    }
+
+    if (opt.stats_name != NULL) {
+#ifdef DUMP_ALL
+        stats_begin(&st, opt.stats_name, Nx, Ny, 2*nsteps);
+#else
+        stats_begin(&st, opt.stats_name, Nx, Ny, nsteps);
+#endif
+    }
+
+    if (opt.ooc.dir != NULL) {
+        const double elapsed = run_out_of_core(filein, seed, opt.cache_dir, Nx, Ny, nsteps,
+                                               &opt.ooc);
+        printf("Elapsed time: %f \n", elapsed);
+        stats_end(&st, opt.stats_name);
+        if (opt.delta_keyint > 0) {
+            delta_end(&dw);
+        }
+        fclose(filein);
+        return EXIT_SUCCESS;
+    }
+
+    const size_t GRID_SIZE = (size_t)Nx*Ny*sizeof(cell_t);
+    cell_t *cur = grid_alloc(Nx, Ny, &opt.mem);
+    cell_t *next = grid_alloc(Nx, Ny, &opt.mem);
+
+    load_problem(filein, cur, Nx, Ny, seed, opt.cache_dir);
+    if (opt.engine == ENGINE_AUTO) {
+        opt.engine = (gas_density(cur, Nx, Ny) < SPARSE_MAX_DENSITY) ? ENGINE_SPARSE : ENGINE_DENSE;
+    }
+    if (opt.autotune) {
+        autotune(cur, Nx, Ny);
+    }
+    double elapsed;
+#ifndef DUMP_ALL
+    if (opt.engine == ENGINE_HASHLIFE) {
+        elapsed = run_hashlife(cur, Nx, nsteps, &opt.hl);
+        write_image(cur, Nx, Ny, nsteps);
+    } else if (opt.engine == ENGINE_SPARSE) {
+        elapsed = run_sparse(cur, Nx, Ny, nsteps);
+        write_image(cur, Nx, Ny, nsteps);
+    } else
+#endif
+    if (opt.perf_counters) {
+        elapsed = run_simulation_perf(cur, next, Nx, Ny, nsteps, "hpp");
+    } else {
+        elapsed = run_simulation(cur, next, Nx, Ny, nsteps, "hpp");
+    }
+    printf("Elapsed time: %f \n", elapsed);
+    stats_end(&st, opt.stats_name);
+    if (opt.delta_keyint > 0) {
+        delta_end(&dw);
+    }
+    hpp_grid_free(cur, GRID_SIZE);
+    hpp_grid_free(next, GRID_SIZE);
+    fclose(filein);
+    return EXIT_SUCCESS;
+}
+#endif